@@ -56,6 +56,9 @@ face_t faces[] = {
 static model_t g_model;
 // note: clipping can produce an additional triangle
 static triangle_t g_triangles_to_raster[2 * sizeof(faces) / sizeof(face_t)];
+static fx32 g_vertices_soa[3][sizeof(vertices) / sizeof(vec3d)];
+static fx32 g_transformed_vertices[3][sizeof(vertices) / sizeof(vec3d)];
+static fx32 g_viewed_vertices[3][sizeof(vertices) / sizeof(vec3d)];
 
 model_t* load_cube() {
     g_model.mesh.nb_faces = sizeof(faces) / sizeof(face_t);
@@ -69,6 +72,12 @@ model_t* load_cube() {
     g_model.mesh.colors = colors;
     g_model.mesh.normals = NULL;
     g_model.triangles_to_raster = g_triangles_to_raster;
+    g_model.transformed_vertices = (vec3d_soa){g_transformed_vertices[0], g_transformed_vertices[1], g_transformed_vertices[2]};
+    g_model.viewed_vertices = (vec3d_soa){g_viewed_vertices[0], g_viewed_vertices[1], g_viewed_vertices[2]};
+    g_model.transformed_normals = (vec3d_soa){NULL, NULL, NULL};
+
+    mesh_init_soa(&g_model.mesh, (vec3d_soa){g_vertices_soa[0], g_vertices_soa[1], g_vertices_soa[2]},
+                  (vec3d_soa){NULL, NULL, NULL});
 
     return &g_model;
 }
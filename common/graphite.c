@@ -14,10 +14,51 @@
 
 #define SORT_TRIANGLES 0
 
-#define MAX_NB_TRIANGLES    16      // maximum number of triangles produced by the clipping
+#define MAX_NB_POLYGON_VERTICES 8       // a triangle clipped against 4 edges has at most 7 vertices
+#define MAX_SCREEN_COORD        2047    // screen coordinates are 12-bit signed in the rasterizer
+#define MAX_BOUNDING_BOX_AREA   (1 << 17)   // edge functions are bounded by the bounding box area, in Q18.14
+
+typedef struct {
+    vec3d p;
+    vec2d t;
+    vec3d c;
+} vertex_t;
+
+typedef struct {
+    vertex_t vertices[MAX_NB_POLYGON_VERTICES];
+    int nb_vertices;
+} polygon_t;
+
+enum { CLIP_LEFT, CLIP_RIGHT, CLIP_TOP, CLIP_BOTTOM, NB_CLIP_EDGES };
 
 void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y,
-                      bool depth_test, bool perspective_correct);
+                      int texture_level, bool depth_test, bool perspective_correct);
+
+static int g_guard_band = 0;
+static int g_texture_nb_levels = 1;
+static draw_stats_t* g_draw_stats = NULL;
+
+void set_guard_band(int guard_band) {
+    if (guard_band < 0) guard_band = 0;
+    if (guard_band > MAX_SCREEN_COORD) guard_band = MAX_SCREEN_COORD;
+    g_guard_band = guard_band;
+}
+
+void set_texture_nb_levels(int nb_levels) { g_texture_nb_levels = nb_levels > 1 ? nb_levels : 1; }
+
+void set_draw_stats(draw_stats_t* stats) { g_draw_stats = stats; }
+
+static void draw_stats_add(draw_stats_t* stats, const draw_stats_t* counters) {
+    stats->nb_faces += counters->nb_faces;
+    stats->nb_faces_culled += counters->nb_faces_culled;
+    stats->nb_faces_near_clipped += counters->nb_faces_near_clipped;
+    stats->nb_triangles_offscreen += counters->nb_triangles_offscreen;
+    stats->nb_triangles_screen_clipped += counters->nb_triangles_screen_clipped;
+    stats->nb_triangles_emitted += counters->nb_triangles_emitted;
+    stats->nb_triangles_degenerate += counters->nb_triangles_degenerate;
+    stats->nb_bounding_box_pixels += counters->nb_bounding_box_pixels;
+    stats->nb_light_bounding_box_pixels += counters->nb_light_bounding_box_pixels;
+}
 
 vec3d matrix_multiply_vector(mat4x4* m, vec3d* i) {
     vec3d r = {MUL(i->x, m->m[0][0]) + MUL(i->y, m->m[1][0]) + MUL(i->z, m->m[2][0]) + m->m[3][0],
@@ -28,6 +69,36 @@ vec3d matrix_multiply_vector(mat4x4* m, vec3d* i) {
     return r;
 }
 
+// Transform a direction (w = 0), the translation of m is not applied
+vec3d matrix_multiply_direction(mat4x4* m, vec3d* i) {
+    vec3d r = {MUL(i->x, m->m[0][0]) + MUL(i->y, m->m[1][0]) + MUL(i->z, m->m[2][0]),
+               MUL(i->x, m->m[0][1]) + MUL(i->y, m->m[1][1]) + MUL(i->z, m->m[2][1]),
+               MUL(i->x, m->m[0][2]) + MUL(i->y, m->m[1][2]) + MUL(i->z, m->m[2][2]),
+               FX(0.0f)};
+
+    return r;
+}
+
+static void matrix_multiply_vectors_row(const fx32* x, const fx32* y, const fx32* z, fx32* out, fx32 m0, fx32 m1, fx32 m2,
+                                        fx32 m3, size_t n) {
+    // note: kept as one output stream per loop so that the host compiler can vectorize it
+    for (size_t i = 0; i < n; ++i) out[i] = MUL(x[i], m0) + MUL(y[i], m1) + MUL(z[i], m2) + m3;
+}
+
+// Transform n points (w = 1) from SoA streams, w is not computed
+void matrix_multiply_vectors_batch(mat4x4* m, vec3d_soa* in, vec3d_soa* out, size_t n) {
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->x, m->m[0][0], m->m[1][0], m->m[2][0], m->m[3][0], n);
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->y, m->m[0][1], m->m[1][1], m->m[2][1], m->m[3][1], n);
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->z, m->m[0][2], m->m[1][2], m->m[2][2], m->m[3][2], n);
+}
+
+// Transform n directions (w = 0) from SoA streams, such as normals, the translation of m is not applied
+void matrix_multiply_directions_batch(mat4x4* m, vec3d_soa* in, vec3d_soa* out, size_t n) {
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->x, m->m[0][0], m->m[1][0], m->m[2][0], FX(0.0f), n);
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->y, m->m[0][1], m->m[1][1], m->m[2][1], FX(0.0f), n);
+    matrix_multiply_vectors_row(in->x, in->y, in->z, out->z, m->m[0][2], m->m[1][2], m->m[2][2], FX(0.0f), n);
+}
+
 vec3d vector_add(vec3d* v1, vec3d* v2) {
     vec3d r = {v1->x + v2->x, v1->y + v2->y, v1->z + v2->z, FX(1.0f)};
     return r;
@@ -267,6 +338,93 @@ int triangle_clip_against_plane(vec3d plane_p, vec3d plane_n, triangle_t* in_tri
     return 0;  // should not happen
 }
 
+// signed distance to a clip edge, the vertex is inside when it is positive or zero
+static fx32 clip_edge_distance(vertex_t* v, int edge, fx32 bound) {
+    switch (edge) {
+        case CLIP_LEFT:
+            return v->p.x - bound;
+        case CLIP_RIGHT:
+            return bound - v->p.x;
+        case CLIP_TOP:
+            return v->p.y - bound;
+        default:
+            return bound - v->p.y;
+    }
+}
+
+static fx32 lerp(fx32 a, fx32 b, fx32 t) { return a + MUL(t, b - a); }
+
+static vertex_t vertex_lerp(vertex_t* a, vertex_t* b, fx32 t) {
+    vertex_t v;
+    v.p = (vec3d){lerp(a->p.x, b->p.x, t), lerp(a->p.y, b->p.y, t), lerp(a->p.z, b->p.z, t), lerp(a->p.w, b->p.w, t)};
+    v.t = (vec2d){lerp(a->t.u, b->t.u, t), lerp(a->t.v, b->t.v, t), lerp(a->t.w, b->t.w, t)};
+    v.c = (vec3d){lerp(a->c.x, b->c.x, t), lerp(a->c.y, b->c.y, t), lerp(a->c.z, b->c.z, t), lerp(a->c.w, b->c.w, t)};
+    return v;
+}
+
+// Sutherland-Hodgman: clip the polygon against one screen edge
+static void clip_polygon_against_edge(polygon_t* polygon, int edge, fx32 bound) {
+    vertex_t inside_vertices[MAX_NB_POLYGON_VERTICES];
+    int nb_inside_vertices = 0;
+
+    vertex_t* previous_vertex = &polygon->vertices[polygon->nb_vertices - 1];
+    fx32 previous_distance = clip_edge_distance(previous_vertex, edge, bound);
+
+    for (int i = 0; i < polygon->nb_vertices; ++i) {
+        vertex_t* current_vertex = &polygon->vertices[i];
+        fx32 current_distance = clip_edge_distance(current_vertex, edge, bound);
+
+        // the edge crosses the clip edge, insert the intersection point
+        if ((previous_distance >= FX(0.0f)) != (current_distance >= FX(0.0f))) {
+            fx32 t = DIV(previous_distance, previous_distance - current_distance);
+            vertex_t v = vertex_lerp(previous_vertex, current_vertex, t);
+            // snap onto the edge to avoid fixed point rounding outside of it
+            if (edge == CLIP_LEFT || edge == CLIP_RIGHT)
+                v.p.x = bound;
+            else
+                v.p.y = bound;
+            inside_vertices[nb_inside_vertices++] = v;
+        }
+
+        if (current_distance >= FX(0.0f)) inside_vertices[nb_inside_vertices++] = *current_vertex;
+
+        previous_vertex = current_vertex;
+        previous_distance = current_distance;
+    }
+
+    memcpy(polygon->vertices, inside_vertices, nb_inside_vertices * sizeof(vertex_t));
+    polygon->nb_vertices = nb_inside_vertices;
+}
+
+// Clip a triangle against the rectangle bounds[] (indexed by clip edge), then fan it out into triangles.
+// Returns the number of triangles written to triangles[] (at most MAX_NB_POLYGON_VERTICES - 2).
+static int triangle_clip_against_rectangle(triangle_t* tri, fx32 bounds[NB_CLIP_EDGES], triangle_t triangles[]) {
+    polygon_t polygon;
+    polygon.nb_vertices = 3;
+    for (int i = 0; i < 3; ++i) {
+        polygon.vertices[i].p = tri->p[i];
+        polygon.vertices[i].t = tri->t[i];
+        polygon.vertices[i].c = tri->c[i];
+    }
+
+    for (int edge = 0; edge < NB_CLIP_EDGES && polygon.nb_vertices > 0; ++edge) {
+        clip_polygon_against_edge(&polygon, edge, bounds[edge]);
+    }
+
+    int nb_triangles = 0;
+    for (int i = 1; i < polygon.nb_vertices - 1; ++i) {
+        vertex_t* v[3] = {&polygon.vertices[0], &polygon.vertices[i], &polygon.vertices[i + 1]};
+        for (int j = 0; j < 3; ++j) {
+            triangles[nb_triangles].p[j] = v[j]->p;
+            triangles[nb_triangles].t[j] = v[j]->t;
+            triangles[nb_triangles].c[j] = v[j]->c;
+        }
+        nb_triangles++;
+    }
+
+    return nb_triangles;
+}
+
 mat4x4 matrix_make_identity() {
     mat4x4 mat;
     memset(&mat, 0, sizeof(mat4x4));
@@ -480,6 +638,226 @@ void sort_triangles(triangle_t triangles[], size_t nb_triangles) {
 }
 #endif // SORT_TRIANGLES
 
+void mesh_init_soa(mesh_t* mesh, vec3d_soa vertices_soa, vec3d_soa normals_soa) {
+    for (size_t i = 0; i < mesh->nb_vertices; ++i) {
+        vertices_soa.x[i] = mesh->vertices[i].x;
+        vertices_soa.y[i] = mesh->vertices[i].y;
+        vertices_soa.z[i] = mesh->vertices[i].z;
+    }
+    mesh->vertices_soa = vertices_soa;
+
+    for (size_t i = 0; i < mesh->nb_normals; ++i) {
+        normals_soa.x[i] = mesh->normals[i].x;
+        normals_soa.y[i] = mesh->normals[i].y;
+        normals_soa.z[i] = mesh->normals[i].z;
+    }
+    mesh->normals_soa = normals_soa;
+}
+
+uint32_t texture_swizzled_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    uint32_t block_size = width < height ? width : height;
+    uint32_t offset = 0;
+    int m = 0;
+    for (; (1u << m) < block_size; ++m) offset |= (((x >> m) & 1) << (2 * m)) | (((y >> m) & 1) << (2 * m + 1));
+    // blocks are along x or along y, the other coordinate is inside the first block
+    return offset | (((x | y) >> m) << (2 * m));
+}
+
+int texture_nb_levels(int texture_scale_x, int texture_scale_y) {
+    return (texture_scale_x < texture_scale_y ? texture_scale_x : texture_scale_y) + 1;
+}
+
+uint32_t texture_level_offset(uint32_t width, uint32_t height, int level) {
+    uint32_t offset = 0;
+    for (int i = 0; i < level; ++i) offset += (width >> i) * (height >> i);
+    return offset;
+}
+
+// Average of 4 ARGB4444 texels, per component
+static uint16_t texel_average(uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+    uint16_t texel = 0;
+    for (int shift = 0; shift < 16; shift += 4) {
+        uint32_t sum = ((a >> shift) & 0xF) + ((b >> shift) & 0xF) + ((c >> shift) & 0xF) + ((d >> shift) & 0xF);
+        texel |= (uint16_t)(((sum + 2) >> 2) << shift);
+    }
+    return texel;
+}
+
+void texture_generate_mipmaps(uint16_t* texels, uint32_t width, uint32_t height, int nb_levels) {
+    for (int level = 1; level < nb_levels; ++level) {
+        uint32_t src_width = width >> (level - 1);
+        uint16_t* src = texels + texture_level_offset(width, height, level - 1);
+        uint16_t* dst = texels + texture_level_offset(width, height, level);
+        for (uint32_t y = 0; y < height >> level; ++y)
+            for (uint32_t x = 0; x < width >> level; ++x) {
+                uint16_t* s = &src[2 * y * src_width + 2 * x];
+                dst[y * (width >> level) + x] = texel_average(s[0], s[1], s[src_width], s[src_width + 1]);
+            }
+    }
+}
+
+uint32_t texture_format_size(int format, uint32_t nb_texels) {
+    switch (format) {
+        case TEXTURE_FORMAT_CLUT8: return nb_texels / 2;
+        case TEXTURE_FORMAT_BLOCK4: return nb_texels / 4;
+        default: return nb_texels;
+    }
+}
+
+static uint32_t texel_distance(uint16_t a, uint16_t b) {
+    uint32_t distance = 0;
+    for (int shift = 0; shift < 16; shift += 4) {
+        int d = ((a >> shift) & 0xF) - ((b >> shift) & 0xF);
+        distance += (uint32_t)(d * d);
+    }
+    return distance;
+}
+
+// Index of the nearest color, the first one on a tie
+static int nearest_color(uint16_t texel, const uint16_t* colors, int nb_colors) {
+    int nearest = 0;
+    uint32_t nearest_distance = UINT32_MAX;
+    for (int i = 0; i < nb_colors; ++i) {
+        uint32_t distance = texel_distance(texel, colors[i]);
+        if (distance < nearest_distance) {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+    return nearest;
+}
+
+typedef struct {
+    uint32_t count;
+    uint16_t color;
+} color_count_t;
+
+// Most frequent first, then by color
+static int compare_color_counts(const void* a, const void* b) {
+    const color_count_t* ca = (const color_count_t*)a;
+    const color_count_t* cb = (const color_count_t*)b;
+    if (ca->count != cb->count) return ca->count < cb->count ? 1 : -1;
+    return (int)ca->color - (int)cb->color;
+}
+
+void texture_quantize_clut8(const uint16_t* texels, uint32_t nb_texels, uint16_t palette[256], uint8_t* indices) {
+    uint32_t* histogram = (uint32_t*)calloc(65536, sizeof(uint32_t));
+    for (uint32_t i = 0; i < nb_texels; ++i) histogram[texels[i]]++;
+
+    int nb_colors = 0;
+    for (uint32_t c = 0; c < 65536; ++c)
+        if (histogram[c] > 0) nb_colors++;
+
+    color_count_t* colors = (color_count_t*)malloc(nb_colors * sizeof(color_count_t));
+    nb_colors = 0;
+    for (uint32_t c = 0; c < 65536; ++c)
+        if (histogram[c] > 0) colors[nb_colors++] = (color_count_t){histogram[c], (uint16_t)c};
+    qsort(colors, nb_colors, sizeof(color_count_t), compare_color_counts);
+
+    int nb_palette_colors = nb_colors < 256 ? nb_colors : 256;
+    for (int i = 0; i < 256; ++i) palette[i] = i < nb_palette_colors ? colors[i].color : 0;
+
+    // the histogram is reused as the index of each color
+    for (int i = 0; i < nb_colors; ++i)
+        histogram[colors[i].color] = (uint32_t)nearest_color(colors[i].color, palette, nb_palette_colors);
+    for (uint32_t i = 0; i < nb_texels; ++i) indices[i] = (uint8_t)histogram[texels[i]];
+
+    free(colors);
+    free(histogram);
+}
+
+// (2 * a + b) / 3 per component, rounded
+static uint16_t texel_mix(uint16_t a, uint16_t b) {
+    uint16_t texel = 0;
+    for (int shift = 0; shift < 16; shift += 4)
+        texel |= (uint16_t)(((2 * ((a >> shift) & 0xF) + ((b >> shift) & 0xF) + 1) / 3) << shift);
+    return texel;
+}
+
+uint32_t texture_block4_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height, bool swizzled) {
+    // the swizzled offset of the first texel of a block is a multiple of 16, the texels of a block being consecutive
+    if (swizzled) return texture_swizzled_offset(x & ~3u, y & ~3u, width, height) / 4;
+    return ((y / 4) * (width / 4) + x / 4) * 4;
+}
+
+uint16_t texture_block4_texel(const uint16_t block[4], int x, int y) {
+    int i = 4 * y + x;
+    switch ((block[2 + i / 8] >> (2 * (i % 8))) & 3) {
+        case 0: return block[0];
+        case 1: return block[1];
+        case 2: return texel_mix(block[0], block[1]);
+        default: return texel_mix(block[1], block[0]);
+    }
+}
+
+void texture_encode_block4(const uint16_t* texels, uint32_t width, uint32_t height, bool swizzled, uint16_t* blocks) {
+    for (uint32_t by = 0; by < height; by += 4)
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            uint16_t block_texels[16];
+            for (int i = 0; i < 16; ++i) block_texels[i] = texels[(by + i / 4) * width + bx + i % 4];
+
+            uint16_t colors[4] = {block_texels[0], block_texels[0]};
+            uint32_t max_distance = 0;
+            for (int i = 0; i < 16; ++i)
+                for (int j = i + 1; j < 16; ++j) {
+                    uint32_t distance = texel_distance(block_texels[i], block_texels[j]);
+                    if (distance > max_distance) {
+                        colors[0] = block_texels[i];
+                        colors[1] = block_texels[j];
+                        max_distance = distance;
+                    }
+                }
+            colors[2] = texel_mix(colors[0], colors[1]);
+            colors[3] = texel_mix(colors[1], colors[0]);
+
+            uint16_t* block = &blocks[texture_block4_offset(bx, by, width, height, swizzled)];
+            block[0] = colors[0];
+            block[1] = colors[1];
+            block[2] = block[3] = 0;
+            for (int i = 0; i < 16; ++i)
+                block[2 + i / 8] |= (uint16_t)(nearest_color(block_texels[i], colors, 4) << (2 * (i % 8)));
+        }
+}
+
+// Mipmap level of a triangle: its area in texels of the level 0 is about 4^level times its area in pixels
+static int triangle_texture_level(triangle_t* t, int texture_scale_x, int texture_scale_y, bool perspective_correct) {
+    int max_level = texture_nb_levels(texture_scale_x, texture_scale_y) - 1;
+    if (max_level > g_texture_nb_levels - 1) max_level = g_texture_nb_levels - 1;
+    if (max_level <= 0) return 0;
+
+    fx32 u[3], v[3];
+    for (int i = 0; i < 3; ++i) {
+        // the perspective correct texture coordinates are divided by w
+        bool is_divided = perspective_correct && t->t[i].w > FX(0.0f);
+        u[i] = is_divided ? DIV(t->t[i].u, t->t[i].w) : t->t[i].u;
+        v[i] = is_divided ? DIV(t->t[i].v, t->t[i].w) : t->t[i].v;
+    }
+
+    // twice the areas, in 18.14
+    int64_t uv_area = ((int64_t)(u[1] - u[0]) * (v[2] - v[0]) - (int64_t)(u[2] - u[0]) * (v[1] - v[0])) >> SCALE;
+    int64_t screen_area = ((int64_t)(t->p[1].x - t->p[0].x) * (t->p[2].y - t->p[0].y) -
+                           (int64_t)(t->p[2].x - t->p[0].x) * (t->p[1].y - t->p[0].y)) >> SCALE;
+    if (uv_area < 0) uv_area = -uv_area;
+    if (screen_area < 0) screen_area = -screen_area;
+
+    // the texture is (32 << texture_scale_x) x (32 << texture_scale_y) texels
+    uint64_t texel_area = (uint64_t)uv_area << (10 + texture_scale_x + texture_scale_y);
+    int level = 0;
+    while (level < max_level && texel_area >= (uint64_t)screen_area << (2 * (level + 1))) level++;
+    return level;
+}
+
+static vec3d soa_get(vec3d_soa* v, int index, fx32 w) {
+    vec3d r = {v->x[index], v->y[index], v->z[index], w};
+    return r;
+}
+
+static void soa_set(vec3d_soa* v, size_t index, vec3d* i) {
+    v->x[index] = i->x;
+    v->y[index] = i->y;
+    v->z[index] = i->z;
+}
+
 static fx32 clamp(fx32 x) {
     if (x < FX(0.0f)) return FX(0.0f);
     if (x > FX(1.0f)) return FX(1.0f);
@@ -525,7 +903,7 @@ void draw_line(vec3d v0, vec3d v1, vec2d uv0, vec2d uv1, vec3d c0, vec3d c1, fx3
         {c1.x, c1.y, c1.z, c1.w}
     };
 
-    xd_draw_triangle(pp0, tt0, cc0, texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, false, perspective_correct);
+    xd_draw_triangle(pp0, tt0, cc0, texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, 0, false, perspective_correct);
 
     vec3d pp1[3] = {
         {vv1.x, vv1.y, vv1.z, FX(0.0)},
@@ -545,64 +923,72 @@ void draw_line(vec3d v0, vec3d v1, vec2d uv0, vec2d uv1, vec3d c0, vec3d c1, fx3
         {c1.x, c1.y, c1.z, c1.w}
     };    
 
-    xd_draw_triangle(pp1, tt1, cc1, texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, false, perspective_correct);
+    xd_draw_triangle(pp1, tt1, cc1, texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, 0, false, perspective_correct);
 }
 
 void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, model_t* model, mat4x4* mat_world,
                 mat4x4* mat_normal, mat4x4* mat_proj, mat4x4* mat_view, light_t* lights, size_t nb_lights, bool is_wireframe, texture_t* texture,
                 bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y, bool perspective_correct) {
     size_t triangle_to_raster_index = 0;
+    draw_stats_t stats = {0};
+
+    // transform each shared vertex once, faces then gather the results by index
+    if (model->mesh.vertices_soa.x != NULL) {
+        matrix_multiply_vectors_batch(mat_world, &model->mesh.vertices_soa, &model->transformed_vertices,
+                                      model->mesh.nb_vertices);
+    } else {
+        for (size_t i = 0; i < model->mesh.nb_vertices; ++i) {
+            vec3d v = matrix_multiply_vector(mat_world, &model->mesh.vertices[i]);
+            soa_set(&model->transformed_vertices, i, &v);
+        }
+    }
+    matrix_multiply_vectors_batch(mat_view, &model->transformed_vertices, &model->viewed_vertices, model->mesh.nb_vertices);
+
+    if (model->mesh.normals && mat_normal != NULL) {
+        if (model->mesh.normals_soa.x != NULL) {
+            matrix_multiply_directions_batch(mat_normal, &model->mesh.normals_soa, &model->transformed_normals,
+                                             model->mesh.nb_normals);
+        } else {
+            for (size_t i = 0; i < model->mesh.nb_normals; ++i) {
+                vec3d n = matrix_multiply_direction(mat_normal, &model->mesh.normals[i]);
+                soa_set(&model->transformed_normals, i, &n);
+            }
+        }
+    }
 
     // draw faces
+    stats.nb_faces = (uint32_t)model->mesh.nb_faces;
     for (size_t i = 0; i < model->mesh.nb_faces; ++i) {
         face_t* face = &model->mesh.faces[i];
-        triangle_t tri;
-        tri.p[0] = model->mesh.vertices[face->indices[0]];
-        tri.p[1] = model->mesh.vertices[face->indices[1]];
-        tri.p[2] = model->mesh.vertices[face->indices[2]];
+        triangle_t tri_viewed, tri_projected, tri_transformed;
+
+        tri_transformed.p[0] = soa_get(&model->transformed_vertices, face->indices[0], FX(1.0f));
+        tri_transformed.p[1] = soa_get(&model->transformed_vertices, face->indices[1], FX(1.0f));
+        tri_transformed.p[2] = soa_get(&model->transformed_vertices, face->indices[2], FX(1.0f));
         if (model->mesh.texcoords) {
-            tri.t[0] = model->mesh.texcoords[face->tex_indices[0]];
-            tri.t[1] = model->mesh.texcoords[face->tex_indices[1]];
-            tri.t[2] = model->mesh.texcoords[face->tex_indices[2]];
+            tri_transformed.t[0] = model->mesh.texcoords[face->tex_indices[0]];
+            tri_transformed.t[1] = model->mesh.texcoords[face->tex_indices[1]];
+            tri_transformed.t[2] = model->mesh.texcoords[face->tex_indices[2]];
         } else {
-            tri.t[0] = (vec2d){FX(0.0f), FX(0.0f)};
-            tri.t[1] = (vec2d){FX(0.0f), FX(0.0f)};
-            tri.t[2] = (vec2d){FX(0.0f), FX(0.0f)};
+            tri_transformed.t[0] = (vec2d){FX(0.0f), FX(0.0f)};
+            tri_transformed.t[1] = (vec2d){FX(0.0f), FX(0.0f)};
+            tri_transformed.t[2] = (vec2d){FX(0.0f), FX(0.0f)};
         }
         if (model->mesh.colors) {
-            tri.c[0] = model->mesh.colors[face->col_indices[0]];
-            tri.c[1] = model->mesh.colors[face->col_indices[1]];
-            tri.c[2] = model->mesh.colors[face->col_indices[2]];
+            tri_transformed.c[0] = model->mesh.colors[face->col_indices[0]];
+            tri_transformed.c[1] = model->mesh.colors[face->col_indices[1]];
+            tri_transformed.c[2] = model->mesh.colors[face->col_indices[2]];
         } else {
-            tri.c[0] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
-            tri.c[1] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
-            tri.c[2] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
+            tri_transformed.c[0] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
+            tri_transformed.c[1] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
+            tri_transformed.c[2] = (vec3d){FX(1.0f), FX(1.0f), FX(1.0f), FX(1.0f)};
         }
-        if (model->mesh.normals) {
-            tri.n[0] = model->mesh.normals[face->norm_indices[0]];
-            tri.n[1] = model->mesh.normals[face->norm_indices[1]];
-            tri.n[2] = model->mesh.normals[face->norm_indices[2]];
-        } else {
-            tri.n[0] = (vec3d){FX(0.0f), FX(0.0f), FX(0.0f), FX(0.0f)};
-            tri.n[1] = (vec3d){FX(0.0f), FX(0.0f), FX(0.0f), FX(0.0f)};
-            tri.n[2] = (vec3d){FX(0.0f), FX(0.0f), FX(0.0f), FX(0.0f)};
-        }
-
-        triangle_t tri_viewed, tri_projected, tri_transformed;
-
-        tri_transformed.p[0] = matrix_multiply_vector(mat_world, &tri.p[0]);
-        tri_transformed.p[1] = matrix_multiply_vector(mat_world, &tri.p[1]);
-        tri_transformed.p[2] = matrix_multiply_vector(mat_world, &tri.p[2]);
-        tri_transformed.t[0] = tri.t[0];
-        tri_transformed.t[1] = tri.t[1];
-        tri_transformed.t[2] = tri.t[2];
-        tri_transformed.c[0] = tri.c[0];
-        tri_transformed.c[1] = tri.c[1];
-        tri_transformed.c[2] = tri.c[2];
-        if (mat_normal != NULL) {
-            tri_transformed.n[0] = matrix_multiply_vector(mat_normal, &tri.n[0]);
-            tri_transformed.n[1] = matrix_multiply_vector(mat_normal, &tri.n[1]);
-            tri_transformed.n[2] = matrix_multiply_vector(mat_normal, &tri.n[2]);
+        if (model->mesh.normals && mat_normal != NULL) {
+            for (int j = 0; j < 3; ++j) {
+                int index = face->norm_indices[j];
+                // note: a missing normal (index -1) contributes ambient light only
+                tri_transformed.n[j] = (index >= 0) ? soa_get(&model->transformed_normals, index, FX(0.0f)) : (vec3d){FX(0.0f), FX(0.0f), FX(0.0f), FX(0.0f)};
+            }
         }
 
         // calculate the normal
@@ -622,8 +1008,9 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
         vec3d vec_camera_ray = vector_sub(&tri_transformed.p[0], vec_camera);
 
         // if ray is aligned with normal, then triangle is visible
-        if (vector_dot_product(&normal, &vec_camera_ray) < FX(0.0f)) {
-    
+        if (vector_dot_product(&normal, &vec_camera_ray) >= FX(0.0f)) {
+            stats.nb_faces_culled++;
+        } else {
             // illumination
             vec3d color[3] = {
                 {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)},
@@ -686,10 +1073,10 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
                 }
             }
 
-            // convert world space to view space
-            tri_viewed.p[0] = matrix_multiply_vector(mat_view, &tri_transformed.p[0]);
-            tri_viewed.p[1] = matrix_multiply_vector(mat_view, &tri_transformed.p[1]);
-            tri_viewed.p[2] = matrix_multiply_vector(mat_view, &tri_transformed.p[2]);
+            // world space to view space (already transformed per vertex)
+            tri_viewed.p[0] = soa_get(&model->viewed_vertices, face->indices[0], FX(1.0f));
+            tri_viewed.p[1] = soa_get(&model->viewed_vertices, face->indices[1], FX(1.0f));
+            tri_viewed.p[2] = soa_get(&model->viewed_vertices, face->indices[2], FX(1.0f));
             tri_viewed.t[0] = tri_transformed.t[0];
             tri_viewed.t[1] = tri_transformed.t[1];
             tri_viewed.t[2] = tri_transformed.t[2];
@@ -704,6 +1091,8 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
             vec3d plane_p = {FX(0.0f), FX(0.0f), z_near, FX(1.0f)};
             vec3d plane_n = {FX(0.0f), FX(0.0f), FX(1.0f), FX(1.0f)};
             nb_clipped_triangles = triangle_clip_against_plane(plane_p, plane_n, &tri_viewed, &clipped[0], &clipped[1]);
+            if (tri_viewed.p[0].z < z_near || tri_viewed.p[1].z < z_near || tri_viewed.p[2].z < z_near)
+                stats.nb_faces_near_clipped++;
 
             for (int n = 0; n < nb_clipped_triangles; ++n) {
                 // project triangles from 3D to 2D
@@ -790,59 +1179,53 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
     sort_triangles(model->triangles_to_raster, triangle_to_raster_index);
 #endif
 
+    // the guard band is limited to what the rasterizer can represent
+    fx32 screen[NB_CLIP_EDGES] = {FXI(0), FXI(viewport_width - 1), FXI(0), FXI(viewport_height - 1)};
+    fx32 guard_band[NB_CLIP_EDGES] = {-FXI(g_guard_band), FXI(viewport_width - 1 + g_guard_band), -FXI(g_guard_band),
+                                      FXI(viewport_height - 1 + g_guard_band)};
+    for (int edge = 0; edge < NB_CLIP_EDGES; ++edge) {
+        if (guard_band[edge] < -FXI(MAX_SCREEN_COORD)) guard_band[edge] = -FXI(MAX_SCREEN_COORD);
+        if (guard_band[edge] > FXI(MAX_SCREEN_COORD)) guard_band[edge] = FXI(MAX_SCREEN_COORD);
+    }
+
     for (size_t i = 0; i < triangle_to_raster_index; ++i) {
         triangle_t tri_to_raster = model->triangles_to_raster[triangle_to_raster_index - i - 1];
 
-        // clip triangles against all four screen edges, this could yield a bunch of triangles
-        triangle_t clipped[2];
-        triangle_t triangles[MAX_NB_TRIANGLES];
+        // triangles within the guard band are left to the rasterizer, which only scans the on-screen part of their
+        // bounding box, provided that their edge functions fit in fixed point; the others are clipped to the screen
+        triangle_t triangles[MAX_NB_POLYGON_VERTICES - 2];
         int nb_triangles = 0;
-        triangles[nb_triangles++] = tri_to_raster;
-
-        int nb_new_triangles = 1;
-
-        for (int p = 0; p < 4; ++p) {
-            int nb_tris_to_add = 0;
-            while (nb_new_triangles > 0) {
-                // pop front
-                triangle_t test = triangles[0];
-                for (int j = 1; j < nb_triangles; ++j) triangles[j - 1] = triangles[j];
-                nb_triangles--;
-
-                nb_new_triangles--;
-
-                switch (p) {
-                    case 0: {
-                        vec3d p = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
-                        vec3d n = {FX(0.0f), FX(1.0f), FX(0.0f), FX(1.0f)};
-                        nb_tris_to_add = triangle_clip_against_plane(p, n, &test, &clipped[0], &clipped[1]);
-                        break;
-                    }
-                    case 1: {
-                        vec3d p = {FX(0.0f), FX((float)(viewport_height - 1)), FX(0.0f), FX(1.0f)};
-                        vec3d n = {FX(0.0f), FX(-1.0f), FX(0.0f), FX(1.0f)};
-                        nb_tris_to_add = triangle_clip_against_plane(p, n, &test, &clipped[0], &clipped[1]);
-                        break;
-                    }
-                    case 2: {
-                        vec3d p = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
-                        vec3d n = {FX(1.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
-                        nb_tris_to_add = triangle_clip_against_plane(p, n, &test, &clipped[0], &clipped[1]);
-                        break;
-                    }
-                    case 3: {
-                        vec3d p = {FX((float)(viewport_width - 1)), FX(0.0f), FX(0.0f), FX(1.0f)};
-                        vec3d n = {FX(-1.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
-                        nb_tris_to_add = triangle_clip_against_plane(p, n, &test, &clipped[0], &clipped[1]);
-                        break;
-                    }
-                }
+        int nb_outside_screen[NB_CLIP_EDGES] = {0};
+        bool is_inside_guard_band = true;
+        for (int j = 0; j < 3; ++j) {
+            vertex_t v = {tri_to_raster.p[j], tri_to_raster.t[j], tri_to_raster.c[j]};
+            for (int edge = 0; edge < NB_CLIP_EDGES; ++edge) {
+                if (clip_edge_distance(&v, edge, screen[edge]) < FX(0.0f)) nb_outside_screen[edge]++;
+                if (clip_edge_distance(&v, edge, guard_band[edge]) < FX(0.0f)) is_inside_guard_band = false;
+            }
+        }
 
-                // push back
-                if (nb_triangles + nb_tris_to_add > MAX_NB_TRIANGLES) break;    // safety net
-                for (int w = 0; w < nb_tris_to_add; ++w) triangles[nb_triangles++] = clipped[w];
+        if (is_inside_guard_band) {
+            fx32 min_x = tri_to_raster.p[0].x, max_x = min_x, min_y = tri_to_raster.p[0].y, max_y = min_y;
+            for (int j = 1; j < 3; ++j) {
+                if (tri_to_raster.p[j].x < min_x) min_x = tri_to_raster.p[j].x;
+                if (tri_to_raster.p[j].x > max_x) max_x = tri_to_raster.p[j].x;
+                if (tri_to_raster.p[j].y < min_y) min_y = tri_to_raster.p[j].y;
+                if (tri_to_raster.p[j].y > max_y) max_y = tri_to_raster.p[j].y;
             }
-            nb_new_triangles = nb_triangles;
+            int area = (INT(max_x) - INT(min_x) + 1) * (INT(max_y) - INT(min_y) + 1);
+            is_inside_guard_band = area < MAX_BOUNDING_BOX_AREA;
+        }
+
+        if (nb_outside_screen[CLIP_LEFT] == 3 || nb_outside_screen[CLIP_RIGHT] == 3 ||
+            nb_outside_screen[CLIP_TOP] == 3 || nb_outside_screen[CLIP_BOTTOM] == 3) {
+            // not visible
+            stats.nb_triangles_offscreen++;
+        } else if (is_inside_guard_band) {
+            triangles[nb_triangles++] = tri_to_raster;
+        } else {
+            nb_triangles = triangle_clip_against_rectangle(&tri_to_raster, screen, triangles);
+            stats.nb_triangles_screen_clipped++;
         }
 
         for (int i = 0; i < nb_triangles; ++i) {
@@ -861,6 +1244,12 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
             // take the cross product of lines to get normal to triangle surface
             normal = vector_cross_product(&line1, &line2);
 
+            // a triangle of zero area covers no pixel (normal.z is minus the area that the rasterizers compute)
+            if (normal.z == FX(0.0f) && !is_wireframe) {
+                stats.nb_triangles_degenerate++;
+                continue;
+            }
+
             if (normal.z > FX(0.0f)) {
                 vec3d tp = t->p[0];
                 vec2d tt = t->t[0];
@@ -874,6 +1263,7 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
             }
 
             // rasterize triangle
+            stats.nb_triangles_emitted++;
             if (is_wireframe) {
                 draw_line((vec3d){t->p[0].x, t->p[0].y, FX(0.0f), FX(0.0f)},
                           (vec3d){t->p[1].x, t->p[1].y, FX(0.0f), FX(0.0f)},
@@ -894,8 +1284,32 @@ void draw_model(int viewport_width, int viewport_height, vec3d* vec_camera, mode
                           (vec3d){t->c[2].x, t->c[2].y, t->c[2].z, t->c[2].w},
                           (vec3d){t->c[0].x, t->c[0].y, t->c[0].z, t->c[0].w}, FX(1.0f), texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, perspective_correct);
             } else {
-                xd_draw_triangle(t->p, t->t, t->c, texture, clamp_s, clamp_t, texture_scale_x, texture_scale_y, true, perspective_correct);
+                int min_x = INT(t->p[0].x), max_x = min_x, min_y = INT(t->p[0].y), max_y = min_y;
+                for (int j = 1; j < 3; ++j) {
+                    int x = INT(t->p[j].x), y = INT(t->p[j].y);
+                    if (x < min_x) min_x = x;
+                    if (x > max_x) max_x = x;
+                    if (y < min_y) min_y = y;
+                    if (y > max_y) max_y = y;
+                }
+                if (min_x < 0) min_x = 0;
+                if (min_y < 0) min_y = 0;
+                if (max_x > viewport_width - 1) max_x = viewport_width - 1;
+                if (max_y > viewport_height - 1) max_y = viewport_height - 1;
+                if (min_x <= max_x && min_y <= max_y) {
+                    uint32_t nb_pixels = (uint32_t)((max_x - min_x + 1) * (max_y - min_y + 1));
+                    stats.nb_bounding_box_pixels += nb_pixels;
+                    stats.nb_light_bounding_box_pixels += nb_pixels * (uint32_t)nb_lights;
+                }
+
+                int level = texture != NULL
+                                ? triangle_texture_level(t, texture_scale_x, texture_scale_y, perspective_correct)
+                                : 0;
+                xd_draw_triangle(t->p, t->t, t->c, texture, clamp_s, clamp_t, texture_scale_x - level,
+                                 texture_scale_y - level, level, true, perspective_correct);
             }
         }
     }
+
+    if (g_draw_stats != NULL) draw_stats_add(g_draw_stats, &stats);
 }
\ No newline at end of file
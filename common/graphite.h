@@ -86,6 +86,13 @@ typedef struct {
     fx32 m[4][4];
 } mat4x4;
 
+// Structure-of-arrays vectors (separate x, y and z streams)
+typedef struct {
+    fx32* x;
+    fx32* y;
+    fx32* z;
+} vec3d_soa;
+
 typedef struct {
     int indices[3];
     int tex_indices[3];
@@ -111,6 +118,10 @@ typedef struct {
     vec3d* colors;
     vec3d* normals;
     face_t* faces;
+
+    // Optional SoA copies of vertices and normals, see mesh_init_soa() (x is NULL when absent)
+    vec3d_soa vertices_soa;
+    vec3d_soa normals_soa;
 } mesh_t;
 
 typedef struct {
@@ -118,6 +129,9 @@ typedef struct {
 
     // Internal buffers
     triangle_t* triangles_to_raster;
+    vec3d_soa transformed_vertices;     // world space, mesh.nb_vertices entries
+    vec3d_soa viewed_vertices;          // view space, mesh.nb_vertices entries
+    vec3d_soa transformed_normals;      // world space, mesh.nb_normals entries
 } model_t;
 
 typedef struct {
@@ -132,6 +146,9 @@ typedef struct {
 } light_t;
 
 vec3d matrix_multiply_vector(mat4x4* m, vec3d* i);
+vec3d matrix_multiply_direction(mat4x4* m, vec3d* i);
+void matrix_multiply_vectors_batch(mat4x4* m, vec3d_soa* in, vec3d_soa* out, size_t n);
+void matrix_multiply_directions_batch(mat4x4* m, vec3d_soa* in, vec3d_soa* out, size_t n);
 vec3d vector_add(vec3d* v1, vec3d* v2);
 vec3d vector_sub(vec3d* v1, vec3d* v2);
 vec3d vector_mul(vec3d* v1, fx32 k);
@@ -153,6 +170,69 @@ mat4x4 matrix_multiply_matrix(mat4x4* m1, mat4x4* m2);
 mat4x4 matrix_point_at(vec3d* pos, vec3d* target, vec3d* up);
 mat4x4 matrix_quick_inverse(mat4x4* m);
 
+void mesh_init_soa(mesh_t* mesh, vec3d_soa vertices_soa, vec3d_soa normals_soa);
+
+// Offset of the texel (x, y) in a swizzled texture (OP_DRAW bit 11): square blocks of min(width, height) texels one
+// after the other, the texels of a block in Morton order. width and height are powers of 2.
+uint32_t texture_swizzled_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+// Mipmaps: the levels of a texture are stored one after the other from the level 0, each level halving the width and
+// the height, down to 32 texels (texture scale 0) on the smallest side. Each level has the layout of the texture.
+int texture_nb_levels(int texture_scale_x, int texture_scale_y);
+
+// Offset of a level, in texels
+uint32_t texture_level_offset(uint32_t width, uint32_t height, int level);
+
+// Computes the levels 1 to nb_levels - 1 of a linear ARGB4444 texture from its level 0, with a 2x2 box filter
+void texture_generate_mipmaps(uint16_t* texels, uint32_t width, uint32_t height, int nb_levels);
+
+// Texture formats (OP_DRAW bits [13:12])
+#define TEXTURE_FORMAT_ARGB4444     0   // 16 bits per texel
+#define TEXTURE_FORMAT_CLUT8        1   // 8-bit index in the palette (OP_SET_PALETTE), 2 texels per word, low byte first
+#define TEXTURE_FORMAT_BLOCK4       2   // 4x4 blocks of 4 words: 2 colors and 16 2-bit indices, 4 bits per texel
+
+// Size in 16-bit words of nb_texels texels of a format. A level offset in words is the size of its offset in texels.
+uint32_t texture_format_size(int format, uint32_t nb_texels);
+
+// CLUT8: palette of the 256 most frequent ARGB4444 colors of the texels, and index of the nearest palette color of
+// each texel
+void texture_quantize_clut8(const uint16_t* texels, uint32_t nb_texels, uint16_t palette[256], uint8_t* indices);
+
+// BLOCK4: the colors of a block are its 2 most distant texels c0 and c1, and their mixes (2 * c0 + c1) / 3 and
+// (c0 + 2 * c1) / 3. The texel (x, y) of a block is the 2-bit index i = 4 * y + x, at bits 2 * (i % 8) of the word
+// 2 + i / 8. The blocks are in the layout of the texture: row by row, or in the order of texture_swizzled_offset().
+void texture_encode_block4(const uint16_t* texels, uint32_t width, uint32_t height, bool swizzled, uint16_t* blocks);
+
+// Offset in words of the block of the texel (x, y)
+uint32_t texture_block4_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height, bool swizzled);
+
+// Color of the texel (x, y) of a block, x and y in [0, 3]
+uint16_t texture_block4_texel(const uint16_t block[4], int x, int y);
+
+// Number of texture levels available to draw_model() (1 by default, no mipmapping). It selects the level of each
+// triangle from its texture to screen area ratio, then xd_draw_triangle() gets the scales of the level.
+void set_texture_nb_levels(int nb_levels);
+
+// Number of pixels around the viewport within which triangles are sent to the rasterizer without being clipped
+// (0 by default). Triangles outside of it, or too large for the rasterizer fixed point range, are still clipped.
+void set_guard_band(int guard_band);
+
+// Pipeline counters of draw_model(), added to the stats given to set_draw_stats() until it is reset
+typedef struct {
+    uint32_t nb_faces;                      // faces processed
+    uint32_t nb_faces_culled;               // back faces
+    uint32_t nb_faces_near_clipped;         // faces crossing the near plane, or behind it
+    uint32_t nb_triangles_offscreen;        // triangles outside of the screen
+    uint32_t nb_triangles_screen_clipped;   // triangles outside of the guard band, clipped to the screen
+    uint32_t nb_triangles_emitted;          // triangles sent to the rasterizer
+    uint32_t nb_triangles_degenerate;       // triangles of zero area, dropped
+    uint32_t nb_bounding_box_pixels;        // on-screen bounding box pixels of the triangles emitted
+    uint32_t nb_light_bounding_box_pixels;  // bounding box pixels per light, summed over the lights
+} draw_stats_t;
+
+// Stats that draw_model() adds its counters to, or NULL (by default) not to count
+void set_draw_stats(draw_stats_t* stats);
+
 void draw_line(vec3d v0, vec3d v1, vec2d uv0, vec2d uv1, vec3d c0, vec3d c1, fx32 thickness, texture_t* texture,
                 bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y, bool perspective_correct);
 
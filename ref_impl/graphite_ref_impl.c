@@ -5,58 +5,239 @@
 #include <SDL.h>
 #include <cube.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <teapot.h>
 
+#include "sw_fragment_shader.h"
 #include "sw_rasterizer.h"
 
 static int screen_width = 320;
 static int screen_height = 240;
 static int screen_scale = 3;
 
-static SDL_Renderer* renderer;
+#define BACKGROUND_COLOR 0x3186     // RGB565 of (50, 50, 50)
 
-bool g_rasterizer_barycentric = true;
+static uint16_t* framebuffer;
 
-void draw_pixel(int x, int y, int color) {
+typedef enum { RASTERIZER_STANDARD, RASTERIZER_BARYCENTRIC, RASTERIZER_TILED, NB_RASTERIZERS } rasterizer_t;
 
-    // Constants taken from https://stackoverflow.com/a/9069480
+static const char* rasterizer_names[NB_RASTERIZERS] = {"standard", "barycentric", "tiled"};
 
-    int r5 = color >> 11;
-    int g6 = (color >> 5) & 0x3F;
-    int b5 = color & 0x1F;
+static rasterizer_t g_rasterizer = RASTERIZER_BARYCENTRIC;
 
-    int r = (r5 * 527 + 23) >> 6;
-    int g = (g6 * 259 + 33) >> 6;
-    int b = (b5 * 527 + 23) >> 6;
+static void clear_framebuffer(uint16_t color) {
+    for (int i = 0; i < screen_width * screen_height; ++i) framebuffer[i] = color;
+}
+
+// Write the frame buffer as a binary PPM image
+static bool write_ppm(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+
+    fprintf(f, "P6\n%d %d\n255\n", screen_width, screen_height);
+    for (int i = 0; i < screen_width * screen_height; ++i) {
+        int color = framebuffer[i];
+
+        // Constants taken from https://stackoverflow.com/a/9069480
+
+        int r5 = color >> 11;
+        int g6 = (color >> 5) & 0x3F;
+        int b5 = color & 0x1F;
+
+        unsigned char rgb[3] = {(r5 * 527 + 23) >> 6, (g6 * 259 + 33) >> 6, (b5 * 527 + 23) >> 6};
+        fwrite(rgb, sizeof(rgb), 1, f);
+    }
 
-    SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
-    SDL_RenderDrawPoint(renderer, x, y);
+    fclose(f);
+    return true;
 }
 
 void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y,
-                      bool depth_test, bool perspective_correct)
+                      int texture_level, bool depth_test, bool perspective_correct)
 {
-    if (g_rasterizer_barycentric) {
-        sw_draw_triangle_barycentric(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w, p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w, p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w, (tex != NULL) ? true : false, clamp_s, clamp_t, depth_test, perspective_correct);
-    } else {
-        sw_draw_triangle_standard(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w, p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w, p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w, (tex != NULL) ? true : false, clamp_s, clamp_t, depth_test, perspective_correct);
+    switch (g_rasterizer) {
+        case RASTERIZER_STANDARD:
+            sw_draw_triangle_standard(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w, p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w, p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w, (tex != NULL) ? true : false, texture_level, clamp_s, clamp_t, depth_test, perspective_correct);
+            break;
+        case RASTERIZER_BARYCENTRIC:
+            sw_draw_triangle_barycentric(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w, p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w, p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w, (tex != NULL) ? true : false, texture_level, clamp_s, clamp_t, depth_test, perspective_correct);
+            break;
+        default:
+            sw_draw_triangle_tiled(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w, p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w, p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w, (tex != NULL) ? true : false, texture_level, clamp_s, clamp_t, depth_test, perspective_correct);
+            break;
+    }
+}
+
+static void print_usage(void) {
+    printf("usage: graphite_ref_impl [--headless] [--frames N] [--output PREFIX] [--size WxH]\n"
+           "                         [--rasterizer standard|barycentric|tiled] [--threads N] [--swizzle]\n"
+           "                         [--mipmaps] [--format argb4444|clut8|block4] [--stats]\n");
+}
+
+// Pipeline counters of draw_model() and pixel counters of the rasterizer, for a frame
+static void print_frame_stats(const draw_stats_t* draw_stats, const sw_rasterizer_stats_t* stats, int width,
+                              int height) {
+    printf("faces: %u, culled: %u, near clipped: %u, triangles offscreen: %u, screen clipped: %u, emitted: %u, "
+           "degenerate: %u, bounding box pixels: %u, per light: %u\n",
+           draw_stats->nb_faces, draw_stats->nb_faces_culled, draw_stats->nb_faces_near_clipped,
+           draw_stats->nb_triangles_offscreen, draw_stats->nb_triangles_screen_clipped,
+           draw_stats->nb_triangles_emitted, draw_stats->nb_triangles_degenerate, draw_stats->nb_bounding_box_pixels,
+           draw_stats->nb_light_bounding_box_pixels);
+
+    uint32_t nb_pixels_walked = stats->nb_pixels_tested + stats->nb_pixels_accepted;
+    printf("pixels tested: %u, accepted: %u, covered: %u, occluded: %u, shaded: %u (efficiency %.1f%%)",
+           stats->nb_pixels_tested, stats->nb_pixels_accepted, stats->nb_pixels_covered, stats->nb_pixels_occluded,
+           stats->nb_pixels_shaded, nb_pixels_walked > 0 ? 100.0f * stats->nb_pixels_shaded / nb_pixels_walked : 0.0f);
+    if (g_rasterizer == RASTERIZER_BARYCENTRIC)
+        printf(", tiles rejected: %u, occluded: %u, accepted: %u, partial: %u", stats->nb_tiles_rejected,
+               stats->nb_tiles_occluded, stats->nb_tiles_accepted, stats->nb_tiles_partial);
+    printf("\n");
+
+    // a clear writes one depth per cycle in graphite
+    if (g_rasterizer == RASTERIZER_BARYCENTRIC)
+        printf("depth fast clear: %u pixels cleared, %u cycles saved\n", stats->nb_depth_pixels_cleared,
+               width * height - stats->nb_depth_pixels_cleared);
+}
+
+// Copy of the texture with nb_levels levels, in a format and in the swizzled layout or not, which the fragment shader
+// samples instead of the linear ARGB4444 level 0
+static uint16_t* make_texture(int nb_levels, bool is_swizzled, int format) {
+    uint32_t size = texture_level_offset(SW_TEXTURE_WIDTH, SW_TEXTURE_HEIGHT, nb_levels);
+    uint16_t* linear = (uint16_t*)malloc(size * sizeof(uint16_t));
+    memcpy(linear, tex, SW_TEXTURE_WIDTH * SW_TEXTURE_HEIGHT * sizeof(uint16_t));
+    texture_generate_mipmaps(linear, SW_TEXTURE_WIDTH, SW_TEXTURE_HEIGHT, nb_levels);
+    if (!is_swizzled && format == TEXTURE_FORMAT_ARGB4444)
+        return linear;
+
+    // the palette is shared by the levels
+    uint8_t* indices = NULL;
+    if (format == TEXTURE_FORMAT_CLUT8) {
+        indices = (uint8_t*)malloc(size);
+        texture_quantize_clut8(linear, size, tex_palette, indices);
+    }
+
+    uint16_t* texture = (uint16_t*)malloc(texture_format_size(format, size) * sizeof(uint16_t));
+    for (int level = 0; level < nb_levels; ++level) {
+        uint32_t width = SW_TEXTURE_WIDTH >> level, height = SW_TEXTURE_HEIGHT >> level;
+        uint32_t offset = texture_level_offset(SW_TEXTURE_WIDTH, SW_TEXTURE_HEIGHT, level);
+        if (format == TEXTURE_FORMAT_BLOCK4) {
+            texture_encode_block4(&linear[offset], width, height, is_swizzled,
+                                  &texture[texture_format_size(format, offset)]);
+            continue;
+        }
+        for (uint32_t y = 0; y < height; ++y)
+            for (uint32_t x = 0; x < width; ++x) {
+                uint32_t texel = offset + (is_swizzled ? texture_swizzled_offset(x, y, width, height) : y * width + x);
+                if (format == TEXTURE_FORMAT_CLUT8)
+                    ((uint8_t*)texture)[texel] = indices[offset + y * width + x];
+                else
+                    texture[texel] = linear[offset + y * width + x];
+            }
+    }
+    free(indices);
+    free(linear);
+    return texture;
+}
+
+static bool parse_texture_format(const char* name, int* format) {
+    const char* names[] = {"argb4444", "clut8", "block4"};
+    for (int i = 0; i < 3; ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            *format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_rasterizer(const char* name, rasterizer_t* rasterizer) {
+    for (int i = 0; i < NB_RASTERIZERS; ++i) {
+        if (strcmp(name, rasterizer_names[i]) == 0) {
+            *rasterizer = (rasterizer_t)i;
+            return true;
+        }
     }
+    return false;
 }
 
-int main() {
-    sw_init_rasterizer_standard(screen_width, screen_height, draw_pixel);
-    sw_init_rasterizer_barycentric(screen_width, screen_height, draw_pixel);
+int main(int argc, char** argv) {
+    // Headless mode: no window, the teapot is animated for a number of frames, which are optionally written
+    // to <output prefix>NNNN.ppm
+    bool is_headless = false;
+    int nb_headless_frames = 100;
+    const char* output_prefix = NULL;
+    int nb_threads = 4;
+    bool is_texture_swizzled = false;
+    int nb_texture_levels = 1;
+    int texture_format = TEXTURE_FORMAT_ARGB4444;
+    bool print_stats = false;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0) {
+            is_headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            nb_headless_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            output_prefix = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0 && has_value &&
+                   sscanf(argv[++i], "%dx%d", &screen_width, &screen_height) == 2 && screen_width > 0 &&
+                   screen_height > 0) {
+            screen_scale = screen_width < 960 ? 960 / screen_width : 1;
+        } else if (strcmp(argv[i], "--rasterizer") == 0 && has_value && parse_rasterizer(argv[++i], &g_rasterizer)) {
+            // rasterizer set
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            nb_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--swizzle") == 0) {
+            is_texture_swizzled = true;
+        } else if (strcmp(argv[i], "--mipmaps") == 0) {
+            nb_texture_levels = SW_TEXTURE_NB_LEVELS;
+        } else if (strcmp(argv[i], "--format") == 0 && has_value && parse_texture_format(argv[++i], &texture_format)) {
+            // texture format set
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
 
-    SDL_Init(SDL_INIT_VIDEO);
+    framebuffer = (uint16_t*)malloc(screen_width * screen_height * sizeof(uint16_t));
 
-    SDL_Window* window =
-        SDL_CreateWindow("Graphite Reference Implementation", SDL_WINDOWPOS_CENTERED_DISPLAY(1),
-                         SDL_WINDOWPOS_UNDEFINED, screen_width * screen_scale, screen_height * screen_scale, 0);
+    sw_init_rasterizer_standard(screen_width, screen_height, framebuffer);
+    sw_init_rasterizer_barycentric(screen_width, screen_height, framebuffer);
+    sw_init_rasterizer_tiled(screen_width, screen_height, nb_threads, framebuffer);
 
-    // SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
+    uint16_t* texture_copy = NULL;
+    if (is_texture_swizzled || nb_texture_levels > 1 || texture_format != TEXTURE_FORMAT_ARGB4444) {
+        texture_copy = make_texture(nb_texture_levels, is_texture_swizzled, texture_format);
+        tex = texture_copy;
+        tex_swizzled = is_texture_swizzled;
+        tex_format = texture_format;
+    }
+    set_texture_nb_levels(nb_texture_levels);
+
+    SDL_Window* window = NULL;
+    SDL_Renderer* renderer = NULL;
+    SDL_Texture* texture = NULL;
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-    SDL_RenderSetScale(renderer, (float)screen_scale, (float)screen_scale);
+    if (is_headless) {
+        SDL_Init(0);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
+
+        window = SDL_CreateWindow("Graphite Reference Implementation", SDL_WINDOWPOS_CENTERED_DISPLAY(1),
+                                  SDL_WINDOWPOS_UNDEFINED, screen_width * screen_scale, screen_height * screen_scale, 0);
+
+        // SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
+
+        // The frame buffer is uploaded once per frame and scaled to the window
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB565, SDL_TEXTUREACCESS_STREAMING, screen_width,
+                                    screen_height);
+    }
 
     SDL_Event e;
     int quit = 0;
@@ -69,9 +250,9 @@ int main() {
 
     model_t* cube_model = load_cube();
     model_t* teapot_model = load_teapot();
-    model_t* current_model = cube_model;
+    model_t* current_model = is_headless ? teapot_model : cube_model;
 
-    bool is_anim = false;
+    bool is_anim = is_headless;
     bool is_wireframe = false;
     size_t nb_lights = 0;
     bool is_gouraud_shading = false;
@@ -79,6 +260,8 @@ int main() {
     bool clamp_s = false;
     bool clamp_t = false;
     bool perspective_correct = true;
+    draw_stats_t draw_stats;
+    set_draw_stats(&draw_stats);
 
     light_t lights[5];
     lights[0].direction = (vec3d){FX(0.0f), FX(0.0f), FX(1.0f), FX(0.0f)};
@@ -98,18 +281,26 @@ int main() {
     lights[4].diffuse_color = (vec3d){FX(0.2f), FX(0.2f), FX(0.0f), FX(1.0f)};    
 
     unsigned int time = SDL_GetTicks();
+    unsigned int start_time = time;
+    int frame_counter = 0;
 
     float yaw = 0.0f;
 
     vec3d vec_up = {FX(0.0f), FX(1.0f), FX(0.0f), FX(1.0f)};
     vec3d vec_camera = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
     while (!quit) {
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, SDL_ALPHA_OPAQUE);
-        SDL_RenderClear(renderer);
-        if (g_rasterizer_barycentric) {
-            sw_clear_depth_buffer_barycentric();
-        } else {
-            sw_clear_depth_buffer_standard();
+        memset(&draw_stats, 0, sizeof(draw_stats));
+        clear_framebuffer(BACKGROUND_COLOR);
+        switch (g_rasterizer) {
+            case RASTERIZER_STANDARD:
+                sw_clear_depth_buffer_standard();
+                break;
+            case RASTERIZER_BARYCENTRIC:
+                sw_clear_depth_buffer_barycentric();
+                break;
+            default:
+                sw_clear_depth_buffer_tiled();
+                break;
         }
 
         //
@@ -151,18 +342,65 @@ int main() {
             draw_line(v0, v1, (vec2d){FX(0.0f), FX(0.0f), FX(0.0f)}, (vec2d){FX(0.0f), FX(0.0f), FX(0.0f)}, c0, c0, FX(1.0f), NULL, true, true, 0, 0, perspective_correct);
         }
 
-        // Draw model
+        // Draw model, the texture is 256x2048 texels (scales 3 and 6)
         texture_t dummy_texture;
         draw_model(screen_width, screen_height, &vec_camera, current_model, &mat_world, is_gouraud_shading ? &mat_normal : NULL, &mat_proj, &mat_view, lights, nb_lights,
-                   is_wireframe, is_textured ? &dummy_texture : NULL, clamp_s, clamp_t, 0, 0, perspective_correct);
+                   is_wireframe, is_textured ? &dummy_texture : NULL, clamp_s, clamp_t, 3, 6, perspective_correct);
+
+        // the tiled rasterizer draws the binned triangles now
+        sw_flush_rasterizer_tiled();
 
-        SDL_RenderPresent(renderer);
+        if (!is_headless) {
+            SDL_UpdateTexture(texture, NULL, framebuffer, screen_width * sizeof(uint16_t));
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+        }
+
+        if (print_stats) {
+            sw_rasterizer_stats_t stats;
+            switch (g_rasterizer) {
+                case RASTERIZER_STANDARD:
+                    stats = sw_get_stats_standard();
+                    break;
+                case RASTERIZER_BARYCENTRIC:
+                    stats = sw_get_stats_barycentric();
+                    break;
+                default:
+                    stats = sw_get_stats_tiled();
+                    break;
+            }
+            print_frame_stats(&draw_stats, &stats, screen_width, screen_height);
+        }
+        sw_reset_stats_standard();
+        sw_reset_stats_barycentric();
+        sw_reset_stats_tiled();
 
         // printf("%d ms\n", SDL_GetTicks() - time);
         float elapsed_time = (float)(SDL_GetTicks() - time) / 1000.0f;
         time = SDL_GetTicks();
 
-        while (SDL_PollEvent(&e)) {
+        frame_counter++;
+        if (is_headless) {
+            if (output_prefix != NULL) {
+                char path[1024];
+                snprintf(path, sizeof(path), "%s%04d.ppm", output_prefix, frame_counter - 1);
+                if (!write_ppm(path)) {
+                    printf("error writing %s\n", path);
+                    quit = 1;
+                }
+            }
+            if (frame_counter >= nb_headless_frames) {
+                unsigned int total_time = SDL_GetTicks() - start_time;
+                printf("%s", rasterizer_names[g_rasterizer]);
+                if (g_rasterizer == RASTERIZER_TILED)
+                    printf(" (%d threads)", nb_threads);
+                printf(", %dx%d: %d frames, %.2f ms/frame\n", screen_width, screen_height, frame_counter,
+                       (float)total_time / frame_counter);
+                quit = 1;
+            }
+        }
+
+        while (!is_headless && SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) {
                 quit = 1;
             } else if (e.type == SDL_KEYDOWN) {
@@ -226,6 +464,9 @@ int main() {
                     case SDL_SCANCODE_SPACE:
                         is_anim = !is_anim;
                         break;
+                    case SDL_SCANCODE_C:
+                        print_stats = !print_stats;
+                        break;
                     case SDL_SCANCODE_KP_PLUS:
                         scale += 1.0f;
                         break;
@@ -234,12 +475,8 @@ int main() {
                             scale -= 1.0f;
                         break;                        
                     case SDL_SCANCODE_BACKSLASH:
-                        g_rasterizer_barycentric = !g_rasterizer_barycentric;
-                        if (g_rasterizer_barycentric) {
-                            printf("Barycentric\n");
-                        } else {
-                            printf("Standard\n");
-                        }
+                        g_rasterizer = (rasterizer_t)((g_rasterizer + 1) % NB_RASTERIZERS);
+                        printf("Rasterizer: %s\n", rasterizer_names[g_rasterizer]);
                         break;
                     default:
                         // do nothing
@@ -251,11 +488,19 @@ int main() {
         if (is_anim) theta += 0.01f;
     }
 
-    SDL_DestroyWindow(window);
+    if (!is_headless) {
+        SDL_DestroyTexture(texture);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+    }
     SDL_Quit();
 
+    sw_dispose_rasterizer_tiled();
     sw_dispose_rasterizer_barycentric();
     sw_dispose_rasterizer_standard();
 
+    free(texture_copy);
+    free(framebuffer);
+
     return 0;
 }
@@ -0,0 +1,385 @@
+// sw_fragment_shader.h
+// Copyright (c) 2024 Daniel Cliche
+// SPDX-License-Identifier: MIT
+
+// Fragment shader of the software rasterizers. The state of a triangle is a combination of SW_SHADER_* flags. The
+// rasterizers instantiate their inner loop for each combination with SW_DEFINE_SHADER_VARIANTS() and select the
+// variant once per triangle, so the flags are constants in the loop and the shader is inlined into it.
+
+#ifndef SW_FRAGMENT_SHADER_H
+#define SW_FRAGMENT_SHADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sw_rasterizer.h"
+
+#if SW_RASTERIZER_SIMD
+#include <immintrin.h>
+#endif
+
+#define SW_SHADER_CLAMP_S           1
+#define SW_SHADER_CLAMP_T           2
+#define SW_SHADER_DEPTH_TEST        4
+#define SW_SHADER_TEXTURE           8
+#define SW_SHADER_PERSP_CORRECT     16
+#define SW_SHADER_NB_VARIANTS       32
+
+#define SW_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#define SW_SHADER_RECIPROCAL_NUMERATOR  256.0f
+
+#define SW_TEXTURE_WIDTH        256
+#define SW_TEXTURE_HEIGHT       2048
+#define SW_TEXTURE_WIDTH_BITS   8
+#define SW_TEXTURE_HEIGHT_BITS  11
+
+// Levels of the mip chain, see texture_level_offset(). tex only holds the levels that draw_model() is allowed to use.
+#define SW_TEXTURE_NB_LEVELS    4
+
+extern uint16_t* tex;
+extern bool tex_swizzled;       // tex is in the layout of texture_swizzled_offset()
+extern int tex_format;          // TEXTURE_FORMAT_* of tex
+extern uint16_t tex_palette[256];
+
+// The level 0 of the swizzled texture is made of SW_TEXTURE_HEIGHT / SW_TEXTURE_WIDTH blocks of 256x256 texels
+#define SW_TEXTURE_BLOCK_BITS   8
+
+static inline int sw_shader_flags(bool clamp_s, bool clamp_t, bool depth_test, bool texture, bool persp_correct) {
+    return (clamp_s ? SW_SHADER_CLAMP_S : 0) | (clamp_t ? SW_SHADER_CLAMP_T : 0) |
+           (depth_test ? SW_SHADER_DEPTH_TEST : 0) | (texture ? SW_SHADER_TEXTURE : 0) |
+           (persp_correct ? SW_SHADER_PERSP_CORRECT : 0);
+}
+
+// Defines name_0 to name_31, which call the kernel name(flags, args) with each combination of flags, and the table
+// name_variants of these functions. params is the parenthesized parameter list of the variants.
+#define SW_SHADER_VARIANT(name, flags, params, ...) \
+    static void name##_##flags params { name(flags, __VA_ARGS__); }
+
+#define SW_DEFINE_SHADER_VARIANTS(name, params, ...) \
+    SW_SHADER_VARIANT(name, 0, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 1, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 2, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 3, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 4, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 5, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 6, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 7, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 8, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 9, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 10, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 11, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 12, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 13, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 14, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 15, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 16, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 17, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 18, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 19, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 20, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 21, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 22, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 23, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 24, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 25, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 26, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 27, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 28, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 29, params, __VA_ARGS__) \
+    SW_SHADER_VARIANT(name, 30, params, __VA_ARGS__) SW_SHADER_VARIANT(name, 31, params, __VA_ARGS__) \
+    static void (*const name##_variants[SW_SHADER_NB_VARIANTS]) params = { \
+        name##_0, name##_1, name##_2, name##_3, name##_4, name##_5, name##_6, name##_7, \
+        name##_8, name##_9, name##_10, name##_11, name##_12, name##_13, name##_14, name##_15, \
+        name##_16, name##_17, name##_18, name##_19, name##_20, name##_21, name##_22, name##_23, \
+        name##_24, name##_25, name##_26, name##_27, name##_28, name##_29, name##_30, name##_31};
+
+// FX(256) / x as reciprocal.sv computes it: the quotient of 256 << 21 by x >> 7, or FX(256) if x >> 7 is 0. A seed of
+// 1 / f, f the divisor normalized to [1, 2), is refined by two Newton-Raphson iterations, then the quotient is
+// corrected with its remainder. The intermediate values are truncated to the widths of reciprocal.sv.
+static inline fx32 sw_reciprocal(uint32_t x) {
+    uint32_t d = x >> 7;
+    if (d == 0)
+        return FX(256);
+    // dn = d << (24 - p), p the leading one of d, is f in 1.24
+    int p = 24;
+    uint32_t dn = d;
+    for (; !(dn >> 24); dn <<= 1)
+        --p;
+    // the seed table of reciprocal.sv, indexed by the 10 bits of f after its leading one, in 1.16
+    uint32_t i = (dn >> 14) & 0x3FF;
+    uint64_t s = ((1u << 27) + (2049 + 2 * i) / 2) / (2049 + 2 * i);
+    uint64_t u = (1ull << 41) - dn * s;                             // 2 - f * s, in 2.40
+    uint64_t r = (uint32_t)((s * u) >> 24);                         // 1 / f, in 0.32
+    uint64_t w = (((1ull << 56) - dn * r) >> 16) & 0x7FFFF;         // 1 - f * r, << 40
+    r = (uint32_t)(r + ((r * w) >> 40));
+    // 2^29 / d = (2^56 / dn) >> (p + 3), at most 1 below the exact quotient
+    uint32_t q = (uint32_t)(r >> (p + 3));
+    uint32_t rem = (1u << 29) - q * d;
+    return (fx32)(rem >= d ? q + 1 : q);
+}
+
+// FX(256) / area of a triangle, the inv_area of sw_setup_planes()
+SW_ALWAYS_INLINE fx32 sw_inv_area(fx32 area) {
+    return area > 0 ? sw_reciprocal((uint32_t)area) : FX(SW_SHADER_RECIPROCAL_NUMERATOR);
+}
+
+// 1 / z of the perspective correction as graphite computes it: the quotient of reciprocal.sv for z << 12, shifted left
+// by 12 (both truncated to 32 bits)
+SW_ALWAYS_INLINE fx32 sw_inv_z(fx32 z) {
+    return (fx32)((uint32_t)sw_reciprocal((uint32_t)z << 12) << 12);
+}
+
+// x * sw_inv_z() as graphite: the low 32 bits of the product >> 14, shifted right by 8 without sign extension
+SW_ALWAYS_INLINE fx32 sw_perspective_correct(fx32 x, fx32 inv_z) {
+    return (fx32)((uint32_t)(((int64_t)x * inv_z) >> SCALE) >> 8);
+}
+
+// Spreads the 8 low bits of x to the even bits
+SW_ALWAYS_INLINE uint32_t sw_morton_spread(uint32_t x) {
+    x = (x | (x << 4)) & 0x0F0F;
+    x = (x | (x << 2)) & 0x3333;
+    return (x | (x << 1)) & 0x5555;
+}
+
+// texture_level_offset() of the texture, the levels are a geometric series of ratio 1/4
+SW_ALWAYS_INLINE int sw_texture_level_offset(int level) {
+    const int size = SW_TEXTURE_WIDTH * SW_TEXTURE_HEIGHT;
+    return (size - (size >> (2 * level))) / 3 * 4;
+}
+
+// Index of the texel (x, y) of a level in tex
+SW_ALWAYS_INLINE int sw_texel_index(int x, int y, int level) {
+    if (tex_swizzled) {
+        int block_bits = SW_TEXTURE_BLOCK_BITS - level;
+        return sw_texture_level_offset(level) +
+               (int)(sw_morton_spread(x) | (sw_morton_spread(y & ((1 << block_bits) - 1)) << 1) |
+                     ((uint32_t)(y >> block_bits) << (2 * block_bits)));
+    }
+    return sw_texture_level_offset(level) + y * (SW_TEXTURE_WIDTH >> level) + x;
+}
+
+// Index in tex of the BLOCK4 block of the texel (x, y) of a level, see texture_block4_offset()
+SW_ALWAYS_INLINE int sw_block_index(int x, int y, int level) {
+    if (tex_swizzled)
+        return sw_texel_index(x & ~3, y & ~3, level) / 4;
+    return sw_texture_level_offset(level) / 4 + (y >> 2) * (SW_TEXTURE_WIDTH >> level) + (x & ~3);
+}
+
+// ARGB4444 color of the texel (x, y) of a level
+SW_ALWAYS_INLINE uint16_t sw_texel(int x, int y, int level) {
+    if (tex_format == TEXTURE_FORMAT_CLUT8)
+        return tex_palette[((const uint8_t*)tex)[sw_texel_index(x, y, level)]];
+    if (tex_format == TEXTURE_FORMAT_BLOCK4)
+        return texture_block4_texel(&tex[sw_block_index(x, y, level)], x & 3, y & 3);
+    return tex[sw_texel_index(x, y, level)];
+}
+
+// Texel coordinate of a clamped or wrapped texture coordinate along size texels, texel_coord() of graphite
+SW_ALWAYS_INLINE int sw_texel_coord(int size, fx32 c) {
+    return (int)(((uint32_t)(size - 1) * (uint32_t)c) >> SCALE);
+}
+
+// ARGB4444 sample of the texture at (u, v), or white without the texture
+SW_ALWAYS_INLINE uint16_t sw_texture_sample(bool texture, int level, fx32 u, fx32 v) {
+    if (texture)
+        return sw_texel(sw_texel_coord(SW_TEXTURE_WIDTH >> level, u), sw_texel_coord(SW_TEXTURE_HEIGHT >> level, v),
+                        level);
+    return 0xFFFF;
+}
+
+// Color component c times a texel component of 5 or 6 bits, modulate() of graphite: the bits 19 to 14 of the 32-bit
+// product
+SW_ALWAYS_INLINE int sw_modulate(int texel, fx32 c) {
+    return (int)(((uint32_t)texel * (uint32_t)c) >> SCALE) & 0x3F;
+}
+
+SW_ALWAYS_INLINE fx32 sw_shader_clamp(fx32 v) {
+    if (v < FX(0.0f)) {
+        v = FX(0.0f);
+    } else if (v > FX(1.0f)) {
+        v = FX(1.0f);
+    }
+    return v;
+}
+
+SW_ALWAYS_INLINE fx32 sw_shader_wrap(fx32 v) {
+    if (v < FX(0.0f)) {
+        v = FX(0.0f);
+    } else if (v >= FX(1.0f)) {
+        //v = FX(fmod(FLT(v), 1.0f));
+        v = v & 0x3FFF;
+    }
+    return v;
+}
+
+// Color (RGB565) of a fragment, texture_level is the mipmap level of the triangle
+SW_ALWAYS_INLINE int sw_shade_fragment(int flags, int texture_level, fx32 z, fx32 u, fx32 v, fx32 r, fx32 g, fx32 b,
+                                       fx32 a) {
+    // Perspective correction
+    if (flags & SW_SHADER_PERSP_CORRECT) {
+        fx32 inv_z = sw_inv_z(z);
+        u = sw_perspective_correct(u, inv_z);
+        v = sw_perspective_correct(v, inv_z);
+        r = sw_perspective_correct(r, inv_z);
+        g = sw_perspective_correct(g, inv_z);
+        b = sw_perspective_correct(b, inv_z);
+        a = sw_perspective_correct(a, inv_z);
+    }
+
+    if (flags & SW_SHADER_CLAMP_S) {
+        u = sw_shader_clamp(u);
+    } else {
+        u = sw_shader_wrap(u);
+    }
+
+    if (flags & SW_SHADER_CLAMP_T) {
+        v = sw_shader_clamp(v);
+    } else {
+        v = sw_shader_wrap(v);
+    }
+
+    // the 4-bit components of the sample are widened to 5 and 6 bits by repeating their high bits
+    int sample = sw_texture_sample(flags & SW_SHADER_TEXTURE, texture_level, u, v);
+    int sr = (sample >> 8) & 0xF, sg = (sample >> 4) & 0xF, sb = sample & 0xF;
+    int rr = sw_modulate(sr << 1 | sr >> 3, r) & 0x1F;
+    int gg = sw_modulate(sg << 2 | sg >> 2, g);
+    int bb = sw_modulate(sb << 1 | sb >> 3, b) & 0x1F;
+
+    return rr << 11 | gg << 5 | bb;
+}
+
+// Depth test of a fragment, then its color and depth are written. Returns false if it failed the depth test.
+SW_ALWAYS_INLINE bool sw_write_fragment(int flags, int texture_level, uint16_t* color, fx32* depth, fx32 z, fx32 u,
+                                        fx32 v, fx32 r, fx32 g, fx32 b, fx32 a) {
+    if (!(flags & SW_SHADER_DEPTH_TEST) || z > *depth) {
+        *color = (uint16_t)sw_shade_fragment(flags, texture_level, z, u, v, r, g, b, a);
+        *depth = z;
+        return true;
+    }
+    return false;
+}
+
+#if SW_RASTERIZER_SIMD
+// MUL() of 8 lanes
+SW_ALWAYS_INLINE __m256i sw_mul_x8(__m256i a, __m256i b) {
+    // only the low 32 bits of the shifted 64-bit products are kept, so the logical shift gives the same result
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), SCALE);
+    __m256i odd = _mm256_srli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)), SCALE);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+// sw_inv_z() of 8 lanes. The quotient of sw_reciprocal() is the floor of the double division, the numerator is below
+// 2^30 so the rounding of the division never reaches the next integer.
+SW_ALWAYS_INLINE __m256i sw_inv_z_x8(__m256i z) {
+    __m256d numerator = _mm256_set1_pd((double)(1 << 29));
+    __m256i d = _mm256_srli_epi32(_mm256_slli_epi32(z, 12), 7);
+    __m128i q[2];
+    for (int i = 0; i < 2; ++i) {
+        __m256d dd = _mm256_cvtepi32_pd(i == 0 ? _mm256_castsi256_si128(d) : _mm256_extracti128_si256(d, 1));
+        q[i] = _mm256_cvttpd_epi32(_mm256_div_pd(numerator, dd));
+    }
+    __m256i inv_z = _mm256_inserti128_si256(_mm256_castsi128_si256(q[0]), q[1], 1);
+    // FX(256) if d is 0
+    __m256i is_zero = _mm256_cmpeq_epi32(d, _mm256_setzero_si256());
+    inv_z = _mm256_blendv_epi8(inv_z, _mm256_set1_epi32(FX(SW_SHADER_RECIPROCAL_NUMERATOR)), is_zero);
+    return _mm256_slli_epi32(inv_z, 12);
+}
+
+// sw_perspective_correct() of 8 lanes
+SW_ALWAYS_INLINE __m256i sw_perspective_correct_x8(__m256i x, __m256i inv_z) {
+    return _mm256_srli_epi32(sw_mul_x8(x, inv_z), 8);
+}
+
+SW_ALWAYS_INLINE __m256i sw_clamp_x8(__m256i v) {
+    return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), _mm256_set1_epi32(FX(1.0f)));
+}
+
+SW_ALWAYS_INLINE __m256i sw_morton_spread_x8(__m256i x) {
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 4)), _mm256_set1_epi32(0x0F0F));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 2)), _mm256_set1_epi32(0x3333));
+    return _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 1)), _mm256_set1_epi32(0x5555));
+}
+
+// sw_texel_index() of 8 texels
+SW_ALWAYS_INLINE __m256i sw_texel_index_x8(__m256i x, __m256i y, int level) {
+    __m256i offset = _mm256_set1_epi32(sw_texture_level_offset(level));
+    if (tex_swizzled) {
+        int block_bits = SW_TEXTURE_BLOCK_BITS - level;
+        __m256i block = _mm256_sll_epi32(_mm256_srl_epi32(y, _mm_cvtsi32_si128(block_bits)),
+                                         _mm_cvtsi32_si128(2 * block_bits));
+        __m256i morton_y = sw_morton_spread_x8(_mm256_and_si256(y, _mm256_set1_epi32((1 << block_bits) - 1)));
+        __m256i morton = _mm256_or_si256(sw_morton_spread_x8(x), _mm256_slli_epi32(morton_y, 1));
+        return _mm256_add_epi32(offset, _mm256_or_si256(morton, block));
+    }
+    __m256i row = _mm256_sll_epi32(y, _mm_cvtsi32_si128(SW_TEXTURE_WIDTH_BITS - level));
+    return _mm256_add_epi32(offset, _mm256_add_epi32(row, x));
+}
+
+SW_ALWAYS_INLINE __m256i sw_wrap_x8(__m256i v) {
+    v = _mm256_max_epi32(v, _mm256_setzero_si256());
+    __m256i is_wrapped = _mm256_cmpgt_epi32(v, _mm256_set1_epi32(FX(1.0f) - 1));
+    return _mm256_blendv_epi8(v, _mm256_and_si256(v, _mm256_set1_epi32(0x3FFF)), is_wrapped);
+}
+
+// sw_texel_coord() of 8 lanes
+SW_ALWAYS_INLINE __m256i sw_texel_coord_x8(int size, __m256i c) {
+    return _mm256_srli_epi32(_mm256_mullo_epi32(c, _mm256_set1_epi32(size - 1)), SCALE);
+}
+
+// sw_modulate() of 8 lanes, texel is the 4-bit component widened to bits bits
+SW_ALWAYS_INLINE __m256i sw_modulate_x8(__m256i texel, int bits, __m256i c) {
+    texel = _mm256_or_si256(_mm256_slli_epi32(texel, bits - 4), _mm256_srli_epi32(texel, 8 - bits));
+    return _mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(texel, c), SCALE),
+                            _mm256_set1_epi32((1 << bits) - 1));
+}
+
+// Colors (RGB565, in the low 16 bits) of 8 fragments, as sw_shade_fragment()
+SW_ALWAYS_INLINE __m256i sw_shade_fragments_x8(int flags, int texture_level, __m256i z, __m256i u, __m256i v,
+                                               __m256i r, __m256i g, __m256i b) {
+    if (flags & SW_SHADER_PERSP_CORRECT) {
+        __m256i inv_z = sw_inv_z_x8(z);
+        u = sw_perspective_correct_x8(u, inv_z);
+        v = sw_perspective_correct_x8(v, inv_z);
+        r = sw_perspective_correct_x8(r, inv_z);
+        g = sw_perspective_correct_x8(g, inv_z);
+        b = sw_perspective_correct_x8(b, inv_z);
+    }
+
+    u = (flags & SW_SHADER_CLAMP_S) ? sw_clamp_x8(u) : sw_wrap_x8(u);
+    v = (flags & SW_SHADER_CLAMP_T) ? sw_clamp_x8(v) : sw_wrap_x8(v);
+
+    // the untextured sample is white
+    __m256i texels = _mm256_set1_epi32(0xFFFF);
+    if (flags & SW_SHADER_TEXTURE) {
+        __m256i x = sw_texel_coord_x8(SW_TEXTURE_WIDTH >> texture_level, u);
+        __m256i y = sw_texel_coord_x8(SW_TEXTURE_HEIGHT >> texture_level, v);
+        int32_t c[8];
+        if (tex_format == TEXTURE_FORMAT_ARGB4444) {
+            int32_t index[8];
+            _mm256_storeu_si256((__m256i*)index, sw_texel_index_x8(x, y, texture_level));
+            for (int i = 0; i < 8; ++i)
+                c[i] = tex[index[i]];
+        } else {
+            int32_t xs[8], ys[8];
+            _mm256_storeu_si256((__m256i*)xs, x);
+            _mm256_storeu_si256((__m256i*)ys, y);
+            for (int i = 0; i < 8; ++i)
+                c[i] = sw_texel(xs[i], ys[i], texture_level);
+        }
+        texels = _mm256_loadu_si256((__m256i*)c);
+    }
+
+    __m256i mask = _mm256_set1_epi32(0xF);
+    __m256i rr = sw_modulate_x8(_mm256_and_si256(_mm256_srli_epi32(texels, 8), mask), 5, r);
+    __m256i gg = sw_modulate_x8(_mm256_and_si256(_mm256_srli_epi32(texels, 4), mask), 6, g);
+    __m256i bb = sw_modulate_x8(_mm256_and_si256(texels, mask), 5, b);
+
+    return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(rr, 11), _mm256_slli_epi32(gg, 5)), bb);
+}
+
+// Stores the colors of the lanes in mask (bit i for lane i) to dst
+SW_ALWAYS_INLINE void sw_store_colors_x8(uint16_t* dst, __m256i colors, int mask) {
+    if (mask == 0xFF) {
+        // the low 16 bits of each lane, without saturation
+        __m256i shuffle = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+                                           0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(colors, shuffle), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+    } else {
+        int32_t c[8];
+        _mm256_storeu_si256((__m256i*)c, colors);
+        for (int i = 0; i < 8; ++i) {
+            if (mask & (1 << i))
+                dst[i] = (uint16_t)c[i];
+        }
+    }
+}
+#endif
+
+#endif  // SW_FRAGMENT_SHADER_H
@@ -6,28 +6,73 @@
 #define SW_RASTERIZER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <graphite.h>
 
-typedef void (*draw_pixel_fn_t)(int x, int y, int color);
+// The barycentric rasterizer processes the rows of its tiles 8 pixels at a time when AVX2 is available. The result
+// is the same as the scalar code, which is used instead with -DSW_RASTERIZER_SIMD=0.
+#ifndef SW_RASTERIZER_SIMD
+#ifdef __AVX2__
+#define SW_RASTERIZER_SIMD 1
+#else
+#define SW_RASTERIZER_SIMD 0
+#endif
+#endif
 
-void sw_init_rasterizer_standard(int fb_width, int fb_height, draw_pixel_fn_t draw_pixel_fn);
+// Coverage counters of the rasterizers, accumulated until they are reset. The standard rasterizer walks the covered
+// pixels only, so they are all tested. The tile counters are those of the barycentric rasterizer.
+typedef struct {
+    uint32_t nb_pixels_tested;      // pixels whose coverage was tested (partially covered tiles)
+    uint32_t nb_pixels_accepted;    // pixels of the tiles fully covered, not tested
+    uint32_t nb_pixels_covered;     // pixels inside of the triangles
+    uint32_t nb_pixels_occluded;    // pixels covered but rejected by the depth test
+    uint32_t nb_pixels_shaded;      // pixels sent to the fragment shader and written
+    uint32_t nb_tiles_rejected;
+    uint32_t nb_tiles_occluded;     // tiles rejected by the coarse depth test
+    uint32_t nb_tiles_accepted;
+    uint32_t nb_tiles_partial;
+    uint32_t nb_depth_pixels_cleared;   // depths cleared when their tile is first drawn to (fast clear)
+} sw_rasterizer_stats_t;
+
+// The rasterizers draw into framebuffer, fb_width x fb_height RGB565 pixels
+void sw_init_rasterizer_standard(int fb_width, int fb_height, uint16_t* framebuffer);
 void sw_dispose_rasterizer_standard();
 void sw_clear_depth_buffer_standard();
+sw_rasterizer_stats_t sw_get_stats_standard();
+void sw_reset_stats_standard();
 
-void sw_init_rasterizer_barycentric(int fb_width, int fb_height, draw_pixel_fn_t draw_pixel_fn);
+void sw_init_rasterizer_barycentric(int fb_width, int fb_height, uint16_t* framebuffer);
 void sw_dispose_rasterizer_barycentric();
+// The depth buffer is fast cleared: a tile is only cleared when it is first drawn to
 void sw_clear_depth_buffer_barycentric();
+sw_rasterizer_stats_t sw_get_stats_barycentric();
+void sw_reset_stats_barycentric();
 
-void sw_fragment_shader(int fb_width, int fb_height, int x, int y, fx32 z, fx32 u, fx32 v, fx32 r, fx32 g, fx32 b, fx32 a, bool clamp_s, bool clamp_t, bool depth_test, bool texture, fx32* depth_buffer, bool persp_correct, draw_pixel_fn_t draw_pixel_fn);
+// The tiled rasterizer bins the triangles and draws them when it is flushed, on a pool of nb_threads worker threads.
+void sw_init_rasterizer_tiled(int fb_width, int fb_height, int nb_threads, uint16_t* framebuffer);
+void sw_dispose_rasterizer_tiled();
+void sw_clear_depth_buffer_tiled();
+void sw_flush_rasterizer_tiled();
+sw_rasterizer_stats_t sw_get_stats_tiled();
+void sw_reset_stats_tiled();
 
+// texture_level is the mipmap level of the texture, see texture_level_offset()
 void sw_draw_triangle_standard(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
                       fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
                       fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
-                      bool texture, bool clamp_s, bool clamp_t, bool depth_test, bool persp_correct);
+                      bool texture, int texture_level, bool clamp_s, bool clamp_t, bool depth_test,
+                      bool persp_correct);
 
 void sw_draw_triangle_barycentric(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
                       fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
                       fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
-                      bool texture, bool clamp_s, bool clamp_t, bool depth_test, bool persp_correct);
+                      bool texture, int texture_level, bool clamp_s, bool clamp_t, bool depth_test,
+                      bool persp_correct);
+
+void sw_draw_triangle_tiled(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
+                      fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
+                      fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
+                      bool texture, int texture_level, bool clamp_s, bool clamp_t, bool depth_test,
+                      bool persp_correct);
 
 #endif  // SW_RASTERIZER_H
\ No newline at end of file
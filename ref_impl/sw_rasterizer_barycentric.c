@@ -6,34 +6,56 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "sw_rasterizer.h"
+#include "sw_fragment_shader.h"
+#include "sw_triangle_setup.h"
 
-#define RECIPROCAL_NUMERATOR    256
+#define TILE_SIZE               8
+#define MIN_COARSE_DEPTH_AREA   FXI(16)     // smaller triangles are not tested against the tile depths
 
 typedef struct {
     fx32 x, y, z, w;
 } sample_t;
 
-int g_fb_width, g_fb_height;
-static draw_pixel_fn_t g_draw_pixel_fn;
+static int g_fb_width, g_fb_height;
+static uint16_t* g_framebuffer;
 
-fx32* g_depth_buffer;
+static fx32* g_depth_buffer;
 
-void sw_init_rasterizer_barycentric(int fb_width, int fb_height, draw_pixel_fn_t draw_pixel_fn) {
+// Farthest depth of each tile (the depth is 1/w, so the lowest value)
+static int g_tiles_width, g_tiles_height;
+static fx32* g_tile_depth_buffer;
+
+// Fast clear, as graphite does it: the depths of a tile are only cleared when it is first drawn to
+static uint8_t* g_is_tile_cleared;
+
+static sw_rasterizer_stats_t g_stats;
+
+void sw_init_rasterizer_barycentric(int fb_width, int fb_height, uint16_t* framebuffer) {
     g_fb_width = fb_width;
     g_fb_height = fb_height;
     g_depth_buffer = (fx32*)malloc(fb_width * fb_height * sizeof(fx32));
-    g_draw_pixel_fn = draw_pixel_fn;
+    g_tiles_width = (fb_width + TILE_SIZE - 1) / TILE_SIZE;
+    g_tiles_height = (fb_height + TILE_SIZE - 1) / TILE_SIZE;
+    g_tile_depth_buffer = (fx32*)malloc(g_tiles_width * g_tiles_height * sizeof(fx32));
+    g_is_tile_cleared = (uint8_t*)calloc(g_tiles_width * g_tiles_height, sizeof(uint8_t));
+    g_framebuffer = framebuffer;
 }
 
-void sw_dispose_rasterizer_barycentric() { free(g_depth_buffer); }
-
-void sw_clear_depth_buffer_barycentric() { memset(g_depth_buffer, FX(0.0f), g_fb_width * g_fb_height * sizeof(fx32)); }
+void sw_dispose_rasterizer_barycentric() {
+    free(g_depth_buffer);
+    free(g_tile_depth_buffer);
+    free(g_is_tile_cleared);
+}
 
-static fx32 reciprocal(fx32 x) {
-    return x > 0 ? DIV(FX(RECIPROCAL_NUMERATOR), x) : FX(RECIPROCAL_NUMERATOR);
+void sw_clear_depth_buffer_barycentric() {
+    memset(g_tile_depth_buffer, FX(0.0f), g_tiles_width * g_tiles_height * sizeof(fx32));
+    memset(g_is_tile_cleared, 1, g_tiles_width * g_tiles_height * sizeof(uint8_t));
 }
 
+sw_rasterizer_stats_t sw_get_stats_barycentric() { return g_stats; }
+
+void sw_reset_stats_barycentric() { memset(&g_stats, 0, sizeof(g_stats)); }
+
 static fx32 edge_function(fx32 a[2], fx32 b[2], fx32 c[2]) {
     return MUL(c[0] - a[0], b[1] - a[1]) - MUL(c[1] - a[1], b[0] - a[0]);
 }
@@ -46,27 +68,48 @@ static int min3(int a, int b, int c) { return min(a, min(b, c)); }
 
 static int max3(int a, int b, int c) { return max(a, max(b, c)); }
 
-void sw_draw_triangle_barycentric(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
-                      fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
-                      fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
-                      bool texture, bool clamp_s, bool clamp_t, bool depth_test, bool persp_correct)
-{
-    fx32 vv0[3] = {x0, y0, z0};
-    fx32 vv1[3] = {x1, y1, z1};
-    fx32 vv2[3] = {x2, y2, z2};
+static fx32 max3_fx(fx32 a, fx32 b, fx32 c) {
+    fx32 m = a >= b ? a : b;
+    return m >= c ? m : c;
+}
+
+// Lowest and highest values of an edge function over a tile of w x h pixels, e is the value at its top-left pixel
+static void edge_range(fx32 e, fx32 dx, fx32 dy, int w, int h, fx32* lo, fx32* hi) {
+    fx32 ex = (w - 1) * dx;
+    fx32 ey = (h - 1) * dy;
+    *lo = e + (ex < FX(0.0f) ? ex : FX(0.0f)) + (ey < FX(0.0f) ? ey : FX(0.0f));
+    *hi = e + (ex > FX(0.0f) ? ex : FX(0.0f)) + (ey > FX(0.0f) ? ey : FX(0.0f));
+}
 
-    fx32 c0[4] = {r0, g0, b0, a0};
-    fx32 c1[4] = {r1, g1, b1, a1};
-    fx32 c2[4] = {r2, g2, b2, a2};
+// Clears the depths of a tile flagged by the last depth buffer clear
+static void clear_tile_depths(int tile_index) {
+    int x0 = (tile_index % g_tiles_width) * TILE_SIZE, y0 = (tile_index / g_tiles_width) * TILE_SIZE;
+    int w = min(TILE_SIZE, g_fb_width - x0), h = min(TILE_SIZE, g_fb_height - y0);
+    for (int y = y0; y < y0 + h; ++y)
+        memset(&g_depth_buffer[y * g_fb_width + x0], FX(0.0f), w * sizeof(fx32));
+    g_is_tile_cleared[tile_index] = 0;
+    g_stats.nb_depth_pixels_cleared += w * h;
+}
+
+#if SW_RASTERIZER_SIMD
+static fx32 min_x8(__m256i v) {
+    __m128i m = _mm_min_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(m);
+}
+#endif
 
-    fx32 t0[3] = {u0, v0, FX(0.0f)};
-    fx32 t1[3] = {u1, v1, FX(0.0f)};
-    fx32 t2[3] = {u2, v2, FX(0.0f)};
+// flags are the SW_SHADER_* flags of the triangle
+SW_ALWAYS_INLINE void draw_triangle(int flags, fx32 vv[3][2], fx32 attributes[3][SW_NB_ATTRIBUTES],
+                                    int texture_level) {
+    fx32 *vv0 = vv[0], *vv1 = vv[1], *vv2 = vv[2];
+    bool depth_test = flags & SW_SHADER_DEPTH_TEST;
 
-    int min_x = min3(INT(x0), INT(x1), INT(x2));
-    int min_y = min3(INT(y0), INT(y1), INT(y2));
-    int max_x = max3(INT(x0), INT(x1), INT(x2));
-    int max_y = max3(INT(y0), INT(y1), INT(y2));
+    int min_x = min3(INT(vv0[0]), INT(vv1[0]), INT(vv2[0]));
+    int min_y = min3(INT(vv0[1]), INT(vv1[1]), INT(vv2[1]));
+    int max_x = max3(INT(vv0[0]), INT(vv1[0]), INT(vv2[0]));
+    int max_y = max3(INT(vv0[1]), INT(vv1[1]), INT(vv2[1]));
 
     min_x = max(min_x, 0);
     min_y = max(min_y, 0);
@@ -75,31 +118,213 @@ void sw_draw_triangle_barycentric(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, f
 
     fx32 area = edge_function(vv0, vv1, vv2);
 
-    for (int y = min_y; y <= max_y; ++y)
-        for (int x = min_x; x <= max_x; ++x) {
-            fx32 pixel_sample[2] = {FXI(x), FXI(y)};
-            fx32 w0 = edge_function(vv1, vv2, pixel_sample);
-            fx32 w1 = edge_function(vv2, vv0, pixel_sample);
-            fx32 w2 = edge_function(vv0, vv1, pixel_sample);
-            if (w0 >= FX(0.0f) && w1 >= FX(0.0f) && w2 >= FX(0.0f)) {
-                fx32 inv_area = reciprocal(area);
-                w0 = MUL(w0, inv_area);
-                w0 = DIV(w0, FX(RECIPROCAL_NUMERATOR));
-                w1 = MUL(w1, inv_area);
-                w1 = DIV(w1, FX(RECIPROCAL_NUMERATOR));
-                w2 = MUL(w2, inv_area);
-                w2 = DIV(w2, FX(RECIPROCAL_NUMERATOR));
-                fx32 u = MUL(w0, t0[0]) + MUL(w1, t1[0]) + MUL(w2, t2[0]);
-                fx32 v = MUL(w0, t0[1]) + MUL(w1, t1[1]) + MUL(w2, t2[1]);
-                fx32 r = MUL(w0, c0[0]) + MUL(w1, c1[0]) + MUL(w2, c2[0]);
-                fx32 g = MUL(w0, c0[1]) + MUL(w1, c1[1]) + MUL(w2, c2[1]);
-                fx32 b = MUL(w0, c0[2]) + MUL(w1, c1[2]) + MUL(w2, c2[2]);
-                fx32 a = MUL(w0, c0[3]) + MUL(w1, c1[3]) + MUL(w2, c2[3]);
-
-                // Perspective correction
-                fx32 z = MUL(w0, vv0[2]) + MUL(w1, vv1[2]) + MUL(w2, vv2[2]);
-
-                sw_fragment_shader(g_fb_width, g_fb_height, x, y, z, u, v, r, g, b, a, clamp_s, clamp_t, depth_test, texture, g_depth_buffer, persp_correct, g_draw_pixel_fn);
+    // The edge functions are linear in x and y, so they are evaluated once at the first pixel and then stepped.
+    // This is exact since MUL(a + FXI(1), b) == MUL(a, b) + b.
+    fx32 w0_dx = vv2[1] - vv1[1], w0_dy = vv1[0] - vv2[0];
+    fx32 w1_dx = vv0[1] - vv2[1], w1_dy = vv2[0] - vv0[0];
+    fx32 w2_dx = vv1[1] - vv0[1], w2_dy = vv0[0] - vv1[0];
+
+    // The interpolated depth can't be closer than the closest vertex. The margin covers the rounding of the
+    // interpolation, which is only small enough for large triangles.
+    bool is_coarse_depth_test = depth_test && area >= MIN_COARSE_DEPTH_AREA;
+    fx32 max_z = max3_fx(attributes[0][SW_ATTR_Z], attributes[1][SW_ATTR_Z], attributes[2][SW_ATTR_Z]);
+    max_z += MUL(max_z, FX(1.0f / 1024.0f)) + FX(1.0f / 4096.0f);
+
+#if SW_RASTERIZER_SIMD
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i lanes_w0_dx = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(w0_dx));
+    __m256i lanes_w1_dx = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(w1_dx));
+    __m256i lanes_w2_dx = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(w2_dx));
+#endif
+
+    fx32 pixel_sample[2] = {FXI(min_x), FXI(min_y)};
+    fx32 w0_min = edge_function(vv1, vv2, pixel_sample);
+    fx32 w1_min = edge_function(vv2, vv0, pixel_sample);
+    fx32 w2_min = edge_function(vv0, vv1, pixel_sample);
+
+    // Triangle setup: the attribute planes, with their origin at the first pixel
+    sw_planes_t planes;
+    sw_setup_planes(&planes, attributes, sw_inv_area(area), (fx32[3]){w0_min, w1_min, w2_min},
+                    (fx32[3]){w0_dx, w1_dx, w2_dx}, (fx32[3]){w0_dy, w1_dy, w2_dy});
+#if SW_RASTERIZER_SIMD
+    sw_plane_lanes_t lanes_dx[SW_NB_ATTRIBUTES];
+    for (int k = 0; k < SW_NB_ATTRIBUTES; ++k)
+        lanes_dx[k] = sw_plane_lanes(planes.dx[k]);
+#endif
+
+    // The bounding box is walked in tiles aligned on TILE_SIZE. Since the edge functions are linear, their values at
+    // the tile corners tell if the tile is outside of the triangle (rejected), inside of it (accepted, the pixels
+    // are not tested) or partially covered.
+    for (int tile_y = min_y; tile_y <= max_y; tile_y = (tile_y & ~(TILE_SIZE - 1)) + TILE_SIZE) {
+        for (int tile_x = min_x; tile_x <= max_x; tile_x = (tile_x & ~(TILE_SIZE - 1)) + TILE_SIZE) {
+            int tile_w = min(tile_x | (TILE_SIZE - 1), max_x) - tile_x + 1;
+            int tile_h = min(tile_y | (TILE_SIZE - 1), max_y) - tile_y + 1;
+
+            fx32 w0_row = w0_min + (tile_x - min_x) * w0_dx + (tile_y - min_y) * w0_dy;
+            fx32 w1_row = w1_min + (tile_x - min_x) * w1_dx + (tile_y - min_y) * w1_dy;
+            fx32 w2_row = w2_min + (tile_x - min_x) * w2_dx + (tile_y - min_y) * w2_dy;
+            uint64_t p_row[SW_NB_ATTRIBUTES];
+            for (int k = 0; k < SW_NB_ATTRIBUTES; ++k)
+                p_row[k] = sw_plane_at(&planes, k, tile_x - min_x, tile_y - min_y);
+
+            fx32 lo0, hi0, lo1, hi1, lo2, hi2;
+            edge_range(w0_row, w0_dx, w0_dy, tile_w, tile_h, &lo0, &hi0);
+            edge_range(w1_row, w1_dx, w1_dy, tile_w, tile_h, &lo1, &hi1);
+            edge_range(w2_row, w2_dx, w2_dy, tile_w, tile_h, &lo2, &hi2);
+
+            if (hi0 < FX(0.0f) || hi1 < FX(0.0f) || hi2 < FX(0.0f)) {
+                g_stats.nb_tiles_rejected++;
+                continue;
+            }
+
+            // the triangle is behind all the pixels of the tile
+            int tile_index = (tile_y / TILE_SIZE) * g_tiles_width + tile_x / TILE_SIZE;
+            if (is_coarse_depth_test && max_z <= g_tile_depth_buffer[tile_index]) {
+                g_stats.nb_tiles_occluded++;
+                continue;
+            }
+
+            // note: graphite only clears the tile at its first covered pixel
+            if (g_is_tile_cleared[tile_index])
+                clear_tile_depths(tile_index);
+
+            bool is_accepted = lo0 >= FX(0.0f) && lo1 >= FX(0.0f) && lo2 >= FX(0.0f);
+
+            // With the depth test, the depths only get closer, so a stale tile depth stays conservative. It is
+            // refreshed when the triangle covers the whole tile, since all its depths are then read. Without the
+            // depth test, the tile depth is lowered to the farthest depth written.
+            bool is_full_tile = is_accepted && (tile_x % TILE_SIZE) == 0 && (tile_y % TILE_SIZE) == 0 &&
+                                tile_w == min(TILE_SIZE, g_fb_width - tile_x) &&
+                                tile_h == min(TILE_SIZE, g_fb_height - tile_y);
+            bool is_written = false;
+            fx32 farthest_z = FX(0.0f);
+            if (is_accepted) {
+                g_stats.nb_tiles_accepted++;
+                g_stats.nb_pixels_accepted += tile_w * tile_h;
+            } else {
+                g_stats.nb_tiles_partial++;
+                g_stats.nb_pixels_tested += tile_w * tile_h;
+            }
+
+#if SW_RASTERIZER_SIMD
+            // the rows of the tile are processed 8 pixels at a time
+            __m256i row_mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(tile_w), lanes);
+            for (int y = tile_y; y < tile_y + tile_h; ++y, w0_row += w0_dy, w1_row += w1_dy, w2_row += w2_dy) {
+                uint64_t p[SW_NB_ATTRIBUTES];
+                for (int k = 0; k < SW_NB_ATTRIBUTES; ++k) {
+                    p[k] = p_row[k];
+                    p_row[k] += planes.dy[k];
+                }
+
+                __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(w0_row), lanes_w0_dx);
+                __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(w1_row), lanes_w1_dx);
+                __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(w2_row), lanes_w2_dx);
+
+                __m256i covered = row_mask;
+                if (!is_accepted) {
+                    __m256i is_outside = _mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), 31);
+                    covered = _mm256_andnot_si256(is_outside, covered);
+                }
+                if (_mm256_testz_si256(covered, covered))
+                    continue;
+
+                // Early depth test, before the other attributes are interpolated
+                fx32* depth_row = &g_depth_buffer[y * g_fb_width + tile_x];
+                __m256i z = sw_plane_values_x8(p[SW_ATTR_Z], lanes_dx[SW_ATTR_Z]);
+                __m256i depth = _mm256_maskload_epi32(depth_row, row_mask);
+                __m256i visible = depth_test ? _mm256_and_si256(covered, _mm256_cmpgt_epi32(z, depth)) : covered;
+                __m256i new_depth = _mm256_blendv_epi8(depth, z, visible);
+                fx32 row_farthest_z = min_x8(_mm256_blendv_epi8(_mm256_set1_epi32(INT32_MAX), new_depth, covered));
+                if (!is_written || row_farthest_z < farthest_z)
+                    farthest_z = row_farthest_z;
+                is_written = true;
+
+                int covered_bits = _mm256_movemask_ps(_mm256_castsi256_ps(covered));
+                int visible_bits = _mm256_movemask_ps(_mm256_castsi256_ps(visible));
+                g_stats.nb_pixels_covered += __builtin_popcount(covered_bits);
+                g_stats.nb_pixels_occluded += __builtin_popcount(covered_bits & ~visible_bits);
+                g_stats.nb_pixels_shaded += __builtin_popcount(visible_bits);
+                if (visible_bits == 0)
+                    continue;
+
+                __m256i u = sw_plane_values_x8(p[SW_ATTR_U], lanes_dx[SW_ATTR_U]);
+                __m256i v = sw_plane_values_x8(p[SW_ATTR_V], lanes_dx[SW_ATTR_V]);
+                __m256i r = sw_plane_values_x8(p[SW_ATTR_R], lanes_dx[SW_ATTR_R]);
+                __m256i g = sw_plane_values_x8(p[SW_ATTR_G], lanes_dx[SW_ATTR_G]);
+                __m256i b = sw_plane_values_x8(p[SW_ATTR_B], lanes_dx[SW_ATTR_B]);
+
+                __m256i colors = sw_shade_fragments_x8(flags, texture_level, z, u, v, r, g, b);
+                sw_store_colors_x8(&g_framebuffer[y * g_fb_width + tile_x], colors, visible_bits);
+                _mm256_maskstore_epi32(depth_row, visible, z);
+            }
+#else
+            for (int y = tile_y; y < tile_y + tile_h; ++y, w0_row += w0_dy, w1_row += w1_dy, w2_row += w2_dy) {
+                fx32 e0 = w0_row, e1 = w1_row, e2 = w2_row;
+                uint64_t p[SW_NB_ATTRIBUTES];
+                for (int k = 0; k < SW_NB_ATTRIBUTES; ++k) {
+                    p[k] = p_row[k];
+                    p_row[k] += planes.dy[k];
+                }
+
+                for (int x = tile_x; x < tile_x + tile_w; ++x, e0 += w0_dx, e1 += w1_dx, e2 += w2_dx) {
+                    if (is_accepted || (e0 >= FX(0.0f) && e1 >= FX(0.0f) && e2 >= FX(0.0f))) {
+                        g_stats.nb_pixels_covered++;
+
+                        // Early depth test, before the other attributes are interpolated
+                        fx32 z = sw_plane_value(p[SW_ATTR_Z]);
+                        fx32 depth = g_depth_buffer[y * g_fb_width + x];
+                        bool is_visible = !depth_test || z > depth;
+                        fx32 new_depth = is_visible ? z : depth;
+                        if (!is_written || new_depth < farthest_z)
+                            farthest_z = new_depth;
+                        is_written = true;
+
+                        if (!is_visible) {
+                            g_stats.nb_pixels_occluded++;
+                        } else {
+                            g_stats.nb_pixels_shaded++;
+
+                            fx32 u = sw_plane_value(p[SW_ATTR_U]);
+                            fx32 v = sw_plane_value(p[SW_ATTR_V]);
+                            fx32 r = sw_plane_value(p[SW_ATTR_R]);
+                            fx32 g = sw_plane_value(p[SW_ATTR_G]);
+                            fx32 b = sw_plane_value(p[SW_ATTR_B]);
+                            fx32 a = sw_plane_value(p[SW_ATTR_A]);
+
+                            int index = y * g_fb_width + x;
+                            g_framebuffer[index] =
+                                (uint16_t)sw_shade_fragment(flags, texture_level, z, u, v, r, g, b, a);
+                            g_depth_buffer[index] = z;
+                        }
+                    }
+
+                    for (int k = 0; k < SW_NB_ATTRIBUTES; ++k)
+                        p[k] += planes.dx[k];
+                }
+            }
+#endif
+
+            if (depth_test ? is_full_tile : is_written) {
+                if (depth_test || farthest_z < g_tile_depth_buffer[tile_index])
+                    g_tile_depth_buffer[tile_index] = farthest_z;
             }
         }
+    }
+}
+
+SW_DEFINE_SHADER_VARIANTS(draw_triangle, (fx32 vv[3][2], fx32 attributes[3][SW_NB_ATTRIBUTES], int texture_level), vv,
+                          attributes, texture_level)
+
+void sw_draw_triangle_barycentric(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
+                      fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
+                      fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
+                      bool texture, int texture_level, bool clamp_s, bool clamp_t, bool depth_test,
+                      bool persp_correct)
+{
+    fx32 vv[3][2] = {{x0, y0}, {x1, y1}, {x2, y2}};
+    fx32 attributes[3][SW_NB_ATTRIBUTES] = {
+        {z0, u0, v0, r0, g0, b0, a0}, {z1, u1, v1, r1, g1, b1, a1}, {z2, u2, v2, r2, g2, b2, a2}};
+
+    int flags = sw_shader_flags(clamp_s, clamp_t, depth_test, texture, persp_correct);
+    draw_triangle_variants[flags](vv, attributes, texture_level);
 }
@@ -0,0 +1,366 @@
+// sw_rasterizer_tiled.c
+// Copyright (c) 2024 Daniel Cliche
+// SPDX-License-Identifier: MIT
+
+// Tile-binned rasterizer. The triangles are binned into screen tiles as they are drawn, then the tiles are
+// rasterized in parallel by a pool of worker threads when the rasterizer is flushed. Each tile owns its colour and
+// depth memory, so the workers share nothing but the triangle list, which is read-only during the flush. The
+// pixels are those of the barycentric rasterizer.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sw_fragment_shader.h"
+#include "sw_triangle_setup.h"
+
+#define BIN_SIZE                64
+
+typedef struct {
+    fx32 p[3][2];       // x, y
+    sw_planes_t planes; // with their origin at (min_x, min_y)
+    int min_x, min_y, max_x, max_y;
+    int flags;          // SW_SHADER_* flags
+    int texture_level;
+} tiled_triangle_t;
+
+typedef struct {
+    int x, y, width, height;
+    uint16_t* color;
+    fx32* depth;
+    uint8_t* is_written;    // pixels written since the last flush
+    int* triangles;         // indices of the binned triangles, in drawing order
+    size_t nb_triangles, triangles_capacity;
+    sw_rasterizer_stats_t stats;    // counted by the worker that draws the bin
+} bin_t;
+
+static int g_fb_width, g_fb_height;
+static uint16_t* g_framebuffer;
+
+static int g_bins_width, g_bins_height;
+static bin_t* g_bins;
+
+static tiled_triangle_t* g_triangles;
+static size_t g_nb_triangles, g_triangles_capacity;
+
+static bool g_is_depth_clear_pending;
+
+// Worker pool
+static int g_nb_threads;
+static pthread_t* g_threads;
+static pthread_mutex_t g_mutex;
+static pthread_cond_t g_work_cond, g_done_cond;
+static unsigned int g_generation;   // incremented at each flush
+static int g_next_bin;
+static int g_nb_busy_threads;
+static bool g_is_quitting;
+
+static fx32 edge_function(const fx32 a[], const fx32 b[], const fx32 c[]) {
+    return MUL(c[0] - a[0], b[1] - a[1]) - MUL(c[1] - a[1], b[0] - a[0]);
+}
+
+static int min(int a, int b) { return (a <= b) ? a : b; }
+
+static int max(int a, int b) { return (a >= b) ? a : b; }
+
+static int min3(int a, int b, int c) { return min(a, min(b, c)); }
+
+static int max3(int a, int b, int c) { return max(a, max(b, c)); }
+
+// Highest value of an edge function over a rectangle of w x h pixels, e is the value at its top-left pixel
+static fx32 edge_max(fx32 e, fx32 dx, fx32 dy, int w, int h) {
+    fx32 ex = (w - 1) * dx;
+    fx32 ey = (h - 1) * dy;
+    return e + (ex > FX(0.0f) ? ex : FX(0.0f)) + (ey > FX(0.0f) ? ey : FX(0.0f));
+}
+
+SW_ALWAYS_INLINE void rasterize_triangle(int flags, bin_t* bin, const tiled_triangle_t* tri) {
+    int min_x = max(tri->min_x, bin->x);
+    int min_y = max(tri->min_y, bin->y);
+    int max_x = min(tri->max_x, bin->x + bin->width - 1);
+    int max_y = min(tri->max_y, bin->y + bin->height - 1);
+
+    const fx32* vv0 = tri->p[0];
+    const fx32* vv1 = tri->p[1];
+    const fx32* vv2 = tri->p[2];
+
+    fx32 w0_dx = vv2[1] - vv1[1], w0_dy = vv1[0] - vv2[0];
+    fx32 w1_dx = vv0[1] - vv2[1], w1_dy = vv2[0] - vv0[0];
+    fx32 w2_dx = vv1[1] - vv0[1], w2_dy = vv0[0] - vv1[0];
+
+    fx32 pixel_sample[2] = {FXI(min_x), FXI(min_y)};
+    fx32 w0_row = edge_function(vv1, vv2, pixel_sample);
+    fx32 w1_row = edge_function(vv2, vv0, pixel_sample);
+    fx32 w2_row = edge_function(vv0, vv1, pixel_sample);
+    uint64_t p_row[SW_NB_ATTRIBUTES];
+    for (int k = 0; k < SW_NB_ATTRIBUTES; ++k)
+        p_row[k] = sw_plane_at(&tri->planes, k, min_x - tri->min_x, min_y - tri->min_y);
+
+    for (int y = min_y; y <= max_y; ++y, w0_row += w0_dy, w1_row += w1_dy, w2_row += w2_dy) {
+        fx32 e0 = w0_row, e1 = w1_row, e2 = w2_row;
+        uint64_t p[SW_NB_ATTRIBUTES];
+        for (int k = 0; k < SW_NB_ATTRIBUTES; ++k) {
+            p[k] = p_row[k];
+            p_row[k] += tri->planes.dy[k];
+        }
+
+        int nb_covered = 0, nb_shaded = 0;
+        int index = (y - bin->y) * BIN_SIZE + min_x - bin->x;
+        for (int x = min_x; x <= max_x; ++x, ++index, e0 += w0_dx, e1 += w1_dx, e2 += w2_dx) {
+            if (e0 >= FX(0.0f) && e1 >= FX(0.0f) && e2 >= FX(0.0f)) {
+                nb_covered++;
+                fx32 z = sw_plane_value(p[SW_ATTR_Z]);
+                if (!(flags & SW_SHADER_DEPTH_TEST) || z > bin->depth[index]) {
+                    nb_shaded++;
+                    fx32 u = sw_plane_value(p[SW_ATTR_U]);
+                    fx32 v = sw_plane_value(p[SW_ATTR_V]);
+                    fx32 r = sw_plane_value(p[SW_ATTR_R]);
+                    fx32 g = sw_plane_value(p[SW_ATTR_G]);
+                    fx32 b = sw_plane_value(p[SW_ATTR_B]);
+                    fx32 a = sw_plane_value(p[SW_ATTR_A]);
+
+                    bin->color[index] = (uint16_t)sw_shade_fragment(flags, tri->texture_level, z, u, v, r, g, b, a);
+                    bin->depth[index] = z;
+                    bin->is_written[index] = 1;
+                }
+            }
+
+            for (int k = 0; k < SW_NB_ATTRIBUTES; ++k)
+                p[k] += tri->planes.dx[k];
+        }
+
+        bin->stats.nb_pixels_tested += max_x - min_x + 1;
+        bin->stats.nb_pixels_covered += nb_covered;
+        bin->stats.nb_pixels_occluded += nb_covered - nb_shaded;
+        bin->stats.nb_pixels_shaded += nb_shaded;
+    }
+}
+
+SW_DEFINE_SHADER_VARIANTS(rasterize_triangle, (bin_t* bin, const tiled_triangle_t* tri), bin, tri)
+
+// Rasterize the triangles of a bin, then copy the pixels written to the frame buffer
+static void process_bin(bin_t* bin, bool is_depth_cleared) {
+    if (is_depth_cleared)
+        memset(bin->depth, FX(0.0f), BIN_SIZE * BIN_SIZE * sizeof(fx32));
+
+    if (bin->nb_triangles == 0)
+        return;
+
+    for (size_t i = 0; i < bin->nb_triangles; ++i) {
+        const tiled_triangle_t* tri = &g_triangles[bin->triangles[i]];
+        rasterize_triangle_variants[tri->flags](bin, tri);
+    }
+
+    for (int y = 0; y < bin->height; ++y) {
+        uint16_t* dst = &g_framebuffer[(bin->y + y) * g_fb_width + bin->x];
+        for (int x = 0; x < bin->width; ++x) {
+            int index = y * BIN_SIZE + x;
+            if (bin->is_written[index]) {
+                dst[x] = bin->color[index];
+                bin->is_written[index] = 0;
+            }
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&g_mutex);
+    for (;;) {
+        while (!g_is_quitting && generation == g_generation)
+            pthread_cond_wait(&g_work_cond, &g_mutex);
+        if (g_is_quitting)
+            break;
+        generation = g_generation;
+
+        bool is_depth_cleared = g_is_depth_clear_pending;
+        while (g_next_bin < g_bins_width * g_bins_height) {
+            bin_t* bin = &g_bins[g_next_bin++];
+            pthread_mutex_unlock(&g_mutex);
+            process_bin(bin, is_depth_cleared);
+            pthread_mutex_lock(&g_mutex);
+        }
+
+        if (--g_nb_busy_threads == 0)
+            pthread_cond_signal(&g_done_cond);
+    }
+    pthread_mutex_unlock(&g_mutex);
+
+    return NULL;
+}
+
+void sw_init_rasterizer_tiled(int fb_width, int fb_height, int nb_threads, uint16_t* framebuffer) {
+    g_fb_width = fb_width;
+    g_fb_height = fb_height;
+    g_framebuffer = framebuffer;
+
+    g_bins_width = (fb_width + BIN_SIZE - 1) / BIN_SIZE;
+    g_bins_height = (fb_height + BIN_SIZE - 1) / BIN_SIZE;
+    g_bins = (bin_t*)calloc(g_bins_width * g_bins_height, sizeof(bin_t));
+    for (int i = 0; i < g_bins_width * g_bins_height; ++i) {
+        bin_t* bin = &g_bins[i];
+        bin->x = (i % g_bins_width) * BIN_SIZE;
+        bin->y = (i / g_bins_width) * BIN_SIZE;
+        bin->width = min(BIN_SIZE, fb_width - bin->x);
+        bin->height = min(BIN_SIZE, fb_height - bin->y);
+        bin->color = (uint16_t*)malloc(BIN_SIZE * BIN_SIZE * sizeof(uint16_t));
+        bin->depth = (fx32*)calloc(BIN_SIZE * BIN_SIZE, sizeof(fx32));
+        bin->is_written = (uint8_t*)calloc(BIN_SIZE * BIN_SIZE, sizeof(uint8_t));
+    }
+
+    g_triangles = NULL;
+    g_nb_triangles = g_triangles_capacity = 0;
+    g_is_depth_clear_pending = false;
+
+    g_nb_threads = max(nb_threads, 1);
+    g_generation = 0;
+    g_is_quitting = false;
+    pthread_mutex_init(&g_mutex, NULL);
+    pthread_cond_init(&g_work_cond, NULL);
+    pthread_cond_init(&g_done_cond, NULL);
+    g_threads = (pthread_t*)malloc(g_nb_threads * sizeof(pthread_t));
+    for (int i = 0; i < g_nb_threads; ++i)
+        pthread_create(&g_threads[i], NULL, worker_main, NULL);
+}
+
+void sw_dispose_rasterizer_tiled() {
+    pthread_mutex_lock(&g_mutex);
+    g_is_quitting = true;
+    pthread_cond_broadcast(&g_work_cond);
+    pthread_mutex_unlock(&g_mutex);
+    for (int i = 0; i < g_nb_threads; ++i)
+        pthread_join(g_threads[i], NULL);
+    free(g_threads);
+
+    pthread_cond_destroy(&g_done_cond);
+    pthread_cond_destroy(&g_work_cond);
+    pthread_mutex_destroy(&g_mutex);
+
+    for (int i = 0; i < g_bins_width * g_bins_height; ++i) {
+        free(g_bins[i].color);
+        free(g_bins[i].depth);
+        free(g_bins[i].is_written);
+        free(g_bins[i].triangles);
+    }
+    free(g_bins);
+    free(g_triangles);
+}
+
+void sw_flush_rasterizer_tiled() {
+    if (g_nb_triangles == 0 && !g_is_depth_clear_pending)
+        return;
+
+    pthread_mutex_lock(&g_mutex);
+    g_next_bin = 0;
+    g_nb_busy_threads = g_nb_threads;
+    g_generation++;
+    pthread_cond_broadcast(&g_work_cond);
+    while (g_nb_busy_threads > 0)
+        pthread_cond_wait(&g_done_cond, &g_mutex);
+    pthread_mutex_unlock(&g_mutex);
+
+    for (int i = 0; i < g_bins_width * g_bins_height; ++i)
+        g_bins[i].nb_triangles = 0;
+    g_nb_triangles = 0;
+    g_is_depth_clear_pending = false;
+}
+
+// The bins are only counted by the workers during a flush
+sw_rasterizer_stats_t sw_get_stats_tiled() {
+    sw_rasterizer_stats_t stats = {0};
+    for (int i = 0; i < g_bins_width * g_bins_height; ++i) {
+        stats.nb_pixels_tested += g_bins[i].stats.nb_pixels_tested;
+        stats.nb_pixels_covered += g_bins[i].stats.nb_pixels_covered;
+        stats.nb_pixels_occluded += g_bins[i].stats.nb_pixels_occluded;
+        stats.nb_pixels_shaded += g_bins[i].stats.nb_pixels_shaded;
+    }
+    return stats;
+}
+
+void sw_reset_stats_tiled() {
+    for (int i = 0; i < g_bins_width * g_bins_height; ++i)
+        memset(&g_bins[i].stats, 0, sizeof(g_bins[i].stats));
+}
+
+void sw_clear_depth_buffer_tiled() {
+    // the triangles already binned are drawn against the previous depths
+    if (g_nb_triangles > 0)
+        sw_flush_rasterizer_tiled();
+    g_is_depth_clear_pending = true;
+}
+
+static void bin_add_triangle(bin_t* bin, int triangle_index) {
+    if (bin->nb_triangles == bin->triangles_capacity) {
+        bin->triangles_capacity = bin->triangles_capacity > 0 ? bin->triangles_capacity * 2 : 64;
+        bin->triangles = (int*)realloc(bin->triangles, bin->triangles_capacity * sizeof(int));
+    }
+    bin->triangles[bin->nb_triangles++] = triangle_index;
+}
+
+void sw_draw_triangle_tiled(fx32 x0, fx32 y0, fx32 z0, fx32 u0, fx32 v0, fx32 r0, fx32 g0, fx32 b0, fx32 a0,
+                      fx32 x1, fx32 y1, fx32 z1, fx32 u1, fx32 v1, fx32 r1, fx32 g1, fx32 b1, fx32 a1,
+                      fx32 x2, fx32 y2, fx32 z2, fx32 u2, fx32 v2, fx32 r2, fx32 g2, fx32 b2, fx32 a2,
+                      bool texture, int texture_level, bool clamp_s, bool clamp_t, bool depth_test,
+                      bool persp_correct)
+{
+    int min_x = max(min3(INT(x0), INT(x1), INT(x2)), 0);
+    int min_y = max(min3(INT(y0), INT(y1), INT(y2)), 0);
+    int max_x = min(max3(INT(x0), INT(x1), INT(x2)), g_fb_width - 1);
+    int max_y = min(max3(INT(y0), INT(y1), INT(y2)), g_fb_height - 1);
+    if (min_x > max_x || min_y > max_y)
+        return;
+
+    if (g_nb_triangles == g_triangles_capacity) {
+        g_triangles_capacity = g_triangles_capacity > 0 ? g_triangles_capacity * 2 : 1024;
+        g_triangles = (tiled_triangle_t*)realloc(g_triangles, g_triangles_capacity * sizeof(tiled_triangle_t));
+    }
+
+    tiled_triangle_t* tri = &g_triangles[g_nb_triangles];
+    *tri = (tiled_triangle_t){
+        .p = {{x0, y0}, {x1, y1}, {x2, y2}},
+        .min_x = min_x, .min_y = min_y, .max_x = max_x, .max_y = max_y,
+        .flags = sw_shader_flags(clamp_s, clamp_t, depth_test, texture, persp_correct),
+        .texture_level = texture_level
+    };
+    fx32 w0_dx = y2 - y1, w0_dy = x1 - x2;
+    fx32 w1_dx = y0 - y2, w1_dy = x2 - x0;
+    fx32 w2_dx = y1 - y0, w2_dy = x0 - x1;
+
+    fx32 pixel_sample[2] = {FXI(min_x), FXI(min_y)};
+    fx32 w0_min = edge_function(tri->p[1], tri->p[2], pixel_sample);
+    fx32 w1_min = edge_function(tri->p[2], tri->p[0], pixel_sample);
+    fx32 w2_min = edge_function(tri->p[0], tri->p[1], pixel_sample);
+
+    fx32 attributes[3][SW_NB_ATTRIBUTES] = {
+        {z0, u0, v0, r0, g0, b0, a0}, {z1, u1, v1, r1, g1, b1, a1}, {z2, u2, v2, r2, g2, b2, a2}};
+    sw_setup_planes(&tri->planes, attributes, sw_inv_area(edge_function(tri->p[0], tri->p[1], tri->p[2])),
+                    (fx32[3]){w0_min, w1_min, w2_min}, (fx32[3]){w0_dx, w1_dx, w2_dx},
+                    (fx32[3]){w0_dy, w1_dy, w2_dy});
+
+    // The triangle is only binned into the tiles where its edge functions can all be positive
+    bool is_binned = false;
+    for (int bin_y = min_y / BIN_SIZE; bin_y <= max_y / BIN_SIZE; ++bin_y) {
+        for (int bin_x = min_x / BIN_SIZE; bin_x <= max_x / BIN_SIZE; ++bin_x) {
+            int x = max(bin_x * BIN_SIZE, min_x);
+            int y = max(bin_y * BIN_SIZE, min_y);
+            int w = min(bin_x * BIN_SIZE + BIN_SIZE - 1, max_x) - x + 1;
+            int h = min(bin_y * BIN_SIZE + BIN_SIZE - 1, max_y) - y + 1;
+
+            fx32 w0 = w0_min + (x - min_x) * w0_dx + (y - min_y) * w0_dy;
+            fx32 w1 = w1_min + (x - min_x) * w1_dx + (y - min_y) * w1_dy;
+            fx32 w2 = w2_min + (x - min_x) * w2_dx + (y - min_y) * w2_dy;
+            if (edge_max(w0, w0_dx, w0_dy, w, h) < FX(0.0f) || edge_max(w1, w1_dx, w1_dy, w, h) < FX(0.0f) ||
+                edge_max(w2, w2_dx, w2_dy, w, h) < FX(0.0f))
+                continue;
+
+            bin_add_triangle(&g_bins[bin_y * g_bins_width + bin_x], (int)g_nb_triangles);
+            is_binned = true;
+        }
+    }
+
+    if (is_binned)
+        g_nb_triangles++;
+}
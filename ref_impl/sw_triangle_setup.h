@@ -0,0 +1,80 @@
+// sw_triangle_setup.h
+// Copyright (c) 2024 Daniel Cliche
+// SPDX-License-Identifier: MIT
+
+// Triangle setup of the barycentric rasterizers. The attributes are interpolated with plane equations computed once
+// per triangle, so the pixels only add the gradients. The plane of an attribute a is
+//
+//     p(x, y) = e0(x, y) * inv_area * a0 + e1(x, y) * inv_area * a1 + e2(x, y) * inv_area * a2
+//
+// where e0, e1 and e2 are the edge functions, and its value is p >> SW_PLANE_SHIFT. The plane is linear in x and y
+// and is computed exactly modulo 2^64, so stepping it gives the same value as evaluating it at each pixel. The
+// triangle setup of graphite.sv computes the same planes.
+
+#ifndef SW_TRIANGLE_SETUP_H
+#define SW_TRIANGLE_SETUP_H
+
+#include <stdint.h>
+
+#include "sw_fragment_shader.h"
+
+enum { SW_ATTR_Z, SW_ATTR_U, SW_ATTR_V, SW_ATTR_R, SW_ATTR_G, SW_ATTR_B, SW_ATTR_A, SW_NB_ATTRIBUTES };
+
+// inv_area is FX(256) / area
+#define SW_PLANE_SHIFT  (2 * SCALE + 8)
+
+typedef struct {
+    uint64_t p[SW_NB_ATTRIBUTES];       // at the origin pixel
+    uint64_t dx[SW_NB_ATTRIBUTES];
+    uint64_t dy[SW_NB_ATTRIBUTES];
+} sw_planes_t;
+
+// Sum of e[i] * inv_area * a[i], modulo 2^64
+static inline uint64_t sw_plane_term(const fx32 e[3], fx32 inv_area, fx32 a0, fx32 a1, fx32 a2) {
+    return (uint64_t)((int64_t)e[0] * inv_area) * (uint64_t)(int64_t)a0 +
+           (uint64_t)((int64_t)e[1] * inv_area) * (uint64_t)(int64_t)a1 +
+           (uint64_t)((int64_t)e[2] * inv_area) * (uint64_t)(int64_t)a2;
+}
+
+// e, e_dx and e_dy are the edge functions at the origin pixel and their gradients, attributes[i] are the attributes
+// of the vertex i
+static inline void sw_setup_planes(sw_planes_t* planes, fx32 attributes[3][SW_NB_ATTRIBUTES], fx32 inv_area,
+                                   const fx32 e[3], const fx32 e_dx[3], const fx32 e_dy[3]) {
+    for (int k = 0; k < SW_NB_ATTRIBUTES; ++k) {
+        fx32 a0 = attributes[0][k], a1 = attributes[1][k], a2 = attributes[2][k];
+        planes->p[k] = sw_plane_term(e, inv_area, a0, a1, a2);
+        planes->dx[k] = sw_plane_term(e_dx, inv_area, a0, a1, a2);
+        planes->dy[k] = sw_plane_term(e_dy, inv_area, a0, a1, a2);
+    }
+}
+
+// Plane of the attribute k, x and y pixels from the origin
+static inline uint64_t sw_plane_at(const sw_planes_t* planes, int k, int x, int y) {
+    return planes->p[k] + (uint64_t)(int64_t)x * planes->dx[k] + (uint64_t)(int64_t)y * planes->dy[k];
+}
+
+static inline fx32 sw_plane_value(uint64_t p) { return (fx32)((int64_t)p >> SW_PLANE_SHIFT); }
+
+#if SW_RASTERIZER_SIMD
+// Gradients of a plane for the lanes 0-3 (lo) and 4-7 (hi)
+typedef struct {
+    __m256i lo, hi;
+} sw_plane_lanes_t;
+
+static inline sw_plane_lanes_t sw_plane_lanes(uint64_t dx) {
+    return (sw_plane_lanes_t){_mm256_setr_epi64x(0, dx, 2 * dx, 3 * dx),
+                              _mm256_setr_epi64x(4 * dx, 5 * dx, 6 * dx, 7 * dx)};
+}
+
+// sw_plane_value() of 8 lanes, p + lane * dx
+SW_ALWAYS_INLINE __m256i sw_plane_values_x8(uint64_t p, sw_plane_lanes_t lanes) {
+    __m256i v = _mm256_set1_epi64x((int64_t)p);
+    // the high 32 bits of each plane, then shifted with their sign
+    __m256i high = _mm256_setr_epi32(1, 3, 5, 7, 1, 3, 5, 7);
+    __m256i lo = _mm256_permutevar8x32_epi32(_mm256_add_epi64(v, lanes.lo), high);
+    __m256i hi = _mm256_permutevar8x32_epi32(_mm256_add_epi64(v, lanes.hi), high);
+    return _mm256_srai_epi32(_mm256_blend_epi32(lo, hi, 0xF0), SW_PLANE_SHIFT - 32);
+}
+#endif
+
+#endif  // SW_TRIANGLE_SETUP_H
@@ -0,0 +1,145 @@
+// test_fragment_shader.c
+// Copyright (c) 2024 Daniel Cliche
+// SPDX-License-Identifier: MIT
+
+// Checks the perspective correction, texel coordinates and color modulation of the fragment shader against the
+// arithmetic of graphite.sv, over sweeps of their inputs, for the scalar and 8-lane versions. Returns 1 if a value
+// differs.
+
+#include <stdio.h>
+
+#include "sw_fragment_shader.h"
+
+// The attribute times 1/z as the PC stage of graphite.sv: reciprocal.sv divides 256 << 21 by (z << 12) >> 7 (the
+// exact quotient, 256 << 14 if the divisor is 0), the quotient is shifted left by 12, multiplied by the attribute in
+// dsp_mul (64 bits, >>> 14) and the low 32 bits of the product are shifted right by 8.
+static fx32 rtl_perspective_correct(fx32 z, fx32 x) {
+    uint32_t reciprocal_x = (uint32_t)z << 12;
+    uint32_t d = reciprocal_x >> 7;
+    uint32_t reciprocal_z = d != 0 ? (1u << 29) / d : 256u << 14;
+    int32_t p1 = (int32_t)(reciprocal_z << 12);
+    int64_t dsp_mul_z = ((int64_t)x * p1) >> 14;
+    return (fx32)((uint32_t)dsp_mul_z >> 8);
+}
+
+// texel_coord() of graphite.svh
+static int rtl_texel_coord(int size, fx32 c) {
+    return (int)((((uint32_t)size - 1u) * (uint32_t)c) >> 14) & 0xFFF;
+}
+
+// The red component of graphite.sv: 5'(modulate({1'b0, r, r[3]}, c))
+static int rtl_modulate_red(int r, fx32 c) {
+    uint32_t texel = (uint32_t)(r << 1 | r >> 3);
+    return (int)(((texel * (uint32_t)c) >> 14) & 0x3F) & 0x1F;
+}
+
+// The green component of graphite.sv: modulate({g, g[3:2]}, c)
+static int rtl_modulate_green(int g, fx32 c) {
+    uint32_t texel = (uint32_t)(g << 2 | g >> 2);
+    return (int)((texel * (uint32_t)c) >> 14) & 0x3F;
+}
+
+static unsigned long check_perspective_correction(unsigned long* nb_checked) {
+    static const fx32 attributes[] = {0, 1, 255, 1237, FX(0.5f), FX(1.0f) - 1, FX(1.0f), FX(1.5f), FXI(3), -1,
+                                      -1237, -FX(1.0f)};
+    const int nb_attributes = (int)(sizeof(attributes) / sizeof(attributes[0]));
+    unsigned long nb_different = 0;
+
+    // z from 0 to past FXI(2), then every 2^k - 1, 2^k and 2^k + 1, the wrap of z << 12 included
+    for (int pass = 0; pass < 2; ++pass) {
+        int nb_z = pass == 0 ? 40000 : 32 * 3;
+        for (int i = 0; i < nb_z; ++i) {
+            fx32 z = pass == 0 ? i : (fx32)((1u << (i / 3)) + (uint32_t)(i % 3) - 1u);
+            fx32 inv_z = sw_inv_z(z);
+            for (int j = 0; j < nb_attributes; ++j) {
+                fx32 expected = rtl_perspective_correct(z, attributes[j]);
+                fx32 value = sw_perspective_correct(attributes[j], inv_z);
+                ++*nb_checked;
+                if (value != expected) {
+                    if (nb_different++ < 10)
+                        printf("z=%d x=%d: %d, graphite %d\n", z, attributes[j], value, expected);
+                }
+            }
+#if SW_RASTERIZER_SIMD
+            __m256i inv_z_x8 = sw_inv_z_x8(_mm256_set1_epi32(z));
+            for (int j = 0; j + 8 <= nb_attributes; j += 4) {
+                int32_t values[8];
+                __m256i x = _mm256_loadu_si256((const __m256i*)&attributes[j]);
+                _mm256_storeu_si256((__m256i*)values, sw_perspective_correct_x8(x, inv_z_x8));
+                for (int k = 0; k < 8; ++k) {
+                    ++*nb_checked;
+                    if (values[k] != rtl_perspective_correct(z, attributes[j + k])) {
+                        if (nb_different++ < 10)
+                            printf("z=%d x=%d: %d (8 lanes), graphite %d\n", z, attributes[j + k], values[k],
+                                   rtl_perspective_correct(z, attributes[j + k]));
+                    }
+                }
+            }
+#endif
+        }
+    }
+
+    return nb_different;
+}
+
+// Counts a checked value, returns true if it differs from graphite and is one of the first 10 that differ
+static bool is_reported(unsigned long* nb_checked, unsigned long* nb_different, int value, int expected) {
+    ++*nb_checked;
+    return value != expected && (*nb_different)++ < 10;
+}
+
+// Texel coordinates of the coordinates 0 to 1 for each level, and red and green components of the colors -1 to 2 for
+// each texel component
+static unsigned long check_texel_coord_modulate(unsigned long* nb_checked) {
+    unsigned long nb_different = 0;
+    for (int level = 0; level < SW_TEXTURE_NB_LEVELS; ++level) {
+        int sizes[2] = {SW_TEXTURE_WIDTH >> level, SW_TEXTURE_HEIGHT >> level};
+        for (int i = 0; i < 2; ++i) {
+            for (fx32 c = 0; c <= FX(1.0f); c += 8) {
+                int expected = rtl_texel_coord(sizes[i], c);
+                int value = sw_texel_coord(sizes[i], c);
+                if (is_reported(nb_checked, &nb_different, value, expected))
+                    printf("size=%d c=%d: texel %d, graphite %d\n", sizes[i], c, value, expected);
+#if SW_RASTERIZER_SIMD
+                int32_t values[8];
+                _mm256_storeu_si256((__m256i*)values, sw_texel_coord_x8(sizes[i], _mm256_set1_epi32(c)));
+                if (is_reported(nb_checked, &nb_different, values[0], expected))
+                    printf("size=%d c=%d: texel %d (8 lanes), graphite %d\n", sizes[i], c, values[0], expected);
+#endif
+            }
+        }
+    }
+    for (int texel = 0; texel < 16; ++texel) {
+        for (fx32 c = -FX(1.0f); c <= FX(2.0f); c += 3) {
+            int expected[2] = {rtl_modulate_red(texel, c), rtl_modulate_green(texel, c)};
+            int values[2] = {sw_modulate(texel << 1 | texel >> 3, c) & 0x1F, sw_modulate(texel << 2 | texel >> 2, c)};
+            for (int i = 0; i < 2; ++i) {
+                if (is_reported(nb_checked, &nb_different, values[i], expected[i]))
+                    printf("texel=%d c=%d: component %d %d, graphite %d\n", texel, c, i, values[i], expected[i]);
+            }
+#if SW_RASTERIZER_SIMD
+            for (int i = 0; i < 2; ++i) {
+                int32_t values_x8[8];
+                __m256i modulated = sw_modulate_x8(_mm256_set1_epi32(texel), 5 + i, _mm256_set1_epi32(c));
+                _mm256_storeu_si256((__m256i*)values_x8, modulated);
+                if (is_reported(nb_checked, &nb_different, values_x8[0], expected[i]))
+                    printf("texel=%d c=%d: component %d %d (8 lanes), graphite %d\n", texel, c, i, values_x8[0],
+                           expected[i]);
+            }
+#endif
+        }
+    }
+    return nb_different;
+}
+
+int main(void) {
+    unsigned long nb_checked = 0;
+    unsigned long nb_different = check_perspective_correction(&nb_checked);
+    printf("perspective correction: %lu values checked, %lu different from graphite\n", nb_checked, nb_different);
+
+    unsigned long nb_texel_checked = 0;
+    unsigned long nb_texel_different = check_texel_coord_modulate(&nb_texel_checked);
+    printf("texel coordinates and modulation: %lu values checked, %lu different from graphite\n", nb_texel_checked,
+           nb_texel_different);
+    return nb_different != 0 || nb_texel_different != 0;
+}
@@ -9,9 +9,11 @@
 module dsp_mul(
     input wire logic signed [31:0] p0,
     input wire logic signed [31:0] p1,
-    output     logic signed [63:0] z
+    output     logic signed [63:0] z,   // mul(p0, p1)
+    output     logic signed [63:0] p    // full product
 );
-    assign z = mul(p0, p1);
+    assign p = $signed({{32{p0[31]}}, p0}) * $signed({{32{p1[31]}}, p1});
+    assign z = p >>> 14;
 endmodule
 
 module graphite #(
@@ -30,14 +32,16 @@ module graphite #(
     input  wire logic                        cmd_axis_tvalid_i,
     output      logic                        cmd_axis_tready_o,
     input  wire logic [31:0]                 cmd_axis_tdata_i,
+    output      logic                        busy_o,    // the stream is also ready while a triangle is rasterized
 
-    // VRAM write
+    // VRAM write: the address is in 16-bit words, the data is the 32-bit word holding it (the even address in the
+    // low half) and the mask selects the bytes written
     output      logic                        vram_sel_o,
     output      logic                        vram_wr_o,
     output      logic  [3:0]                 vram_mask_o,
     output      logic [31:0]                 vram_addr_o,
-    input       logic [15:0]                 vram_data_in_i,
-    output      logic [15:0]                 vram_data_out_o,
+    input       logic [31:0]                 vram_data_in_i,
+    output      logic [31:0]                 vram_data_out_o,
 
     input  wire logic                        vsync_i,
     output      logic                        swap_o,
@@ -45,21 +49,19 @@ module graphite #(
     output      logic                        clear_o
     );
 
-    enum { WAIT_COMMAND, PROCESS_COMMAND, SWAP0, CLEAR_FB0, CLEAR_DEPTH0,
-           DRAW_TRIANGLE00, DRAW_TRIANGLE01, DRAW_TRIANGLE02, DRAW_TRIANGLE04, DRAW_TRIANGLE05,
-           DRAW_TRIANGLE07,
-           DRAW_TRIANGLE12, DRAW_TRIANGLE13, DRAW_TRIANGLE15,
-           DRAW_TRIANGLE18, DRAW_TRIANGLE21,
-           DRAW_TRIANGLE24, DRAW_TRIANGLE25, DRAW_TRIANGLE28, 
-           DRAW_TRIANGLE31, DRAW_TRIANGLE32, DRAW_TRIANGLE35,
-           DRAW_TRIANGLE36, DRAW_TRIANGLE37, DRAW_TRIANGLE38, DRAW_TRIANGLE39, DRAW_TRIANGLE40, DRAW_TRIANGLE41,
-           DRAW_TRIANGLE42, DRAW_TRIANGLE43,
-           DRAW_TRIANGLE48, DRAW_TRIANGLE49, DRAW_TRIANGLE51, DRAW_TRIANGLE52, DRAW_TRIANGLE53,
-           DRAW_TRIANGLE54, DRAW_TRIANGLE55, DRAW_TRIANGLE56, DRAW_TRIANGLE57, DRAW_TRIANGLE58, DRAW_TRIANGLE59,
-           DRAW_TRIANGLE60
+    enum { WAIT_COMMAND, PROCESS_COMMAND, SWAP0, CLEAR_FB0, CLEAR_DEPTH0, CLEAR_TILES0, FILL_TILE0, FILL_TILE1,
+           RESOLVE_TILES0, FLUSH_WRITES0, DRAW_PACKED0, DRAW_PACKED1,
+           DRAW_TRIANGLE00, DRAW_TRIANGLE01, DRAW_TRIANGLE02, DRAW_TRIANGLE03, DRAW_TRIANGLE04, DRAW_TRIANGLE05,
+           DRAW_TRIANGLE07, DRAW_TRIANGLE08, DRAW_TRIANGLE09, DRAW_TRIANGLE10,
+           DRAW_TRIANGLE12
     } state;
 
     localparam NB_DSP_MULS = 6;
+    localparam PACKED_XY_MASK = {16'hFFFF, 16'(SUBPIXEL_PRECISION_MASK)};
+
+    // Interpolated attributes
+    localparam NB_ATTRIBUTES = 6;
+    localparam ATTR_Z = 0, ATTR_R = 1, ATTR_G = 2, ATTR_B = 3, ATTR_S = 4, ATTR_T = 5;
 
     logic signed [31:0] vv00, vv01, vv02, vv10, vv11, vv12, vv20, vv21, vv22;
     logic signed [31:0] c00, c01, c02;
@@ -67,6 +69,7 @@ module graphite #(
     logic signed [31:0] c20, c21, c22;
     logic signed [31:0] st00, st01, st10, st11, st20, st21;
 
+    logic [31:0] command;                               // taken from the stream, which may move on
     logic signed [11:0] x, y;
     
     logic [31:0] fb_address, texture_address;
@@ -79,27 +82,179 @@ module graphite #(
 
     logic [2:0] texture_width_scale;
     logic [2:0] texture_height_scale;
+    logic [1:0] texture_format;
+
+    // Palette of the CLUT8 textures, in BRAM
+    logic [15:0] palette[256];
+
+    // Fast clear: the tiles of a buffer are flagged instead of written, and a flagged tile is filled with the clear
+    // value when a triangle first covers one of its pixels. The color tiles left are filled at OP_SWAP, since the
+    // scanout reads the frame buffer from VRAM. The flags are in BRAM, 32 tiles per word. The words of the tile of
+    // (x, y) are read the cycle before they are used, so the raster waits a cycle when it enters another word, and a
+    // flag is cleared by writing back its word.
+    localparam TILE_SHIFT = 3;
+    localparam TILE_SIZE = 1 << TILE_SHIFT;
+    localparam TILES_WIDTH = (FB_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    localparam TILES_HEIGHT = (FB_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    localparam NB_TILE_WORDS = (TILES_WIDTH * TILES_HEIGHT + 31) / 32;
+
+    logic [31:0] depth_tile_flags[NB_TILE_WORDS];
+    logic [31:0] color_tile_flags[NB_TILE_WORDS];   // of the back buffer
+    logic [15:0] depth_clear_value, color_clear_value;
+    logic        is_fast_clear, is_depth_clear;
+    logic  [1:0] tile_flags_sel;                    // flags written by CLEAR_TILES0: bit 0 depth, bit 1 color
+    logic        tile_flags_value;
+    logic        is_color_resolve_pending;
+    logic        is_resolving;
+    logic [31:0] tile_word;                         // flag word written by CLEAR_TILES0
+    logic [31:0] tile_index;                        // tile of the pixel (x, y)
+    logic [31:0] tile_read_word;                    // flag words read, of the tile of (x, y) in the previous cycle
+    logic [31:0] depth_tile_word, color_tile_word;
+    logic        is_tile_word_stale;                // the flags were written in the previous cycle
+    logic        is_tile_word_valid;
+    logic        is_depth_tile_cleared, is_color_tile_cleared;
+    logic        is_fill_depth;
+    logic signed [11:0] fill_x, fill_y, fill_min_x, fill_max_x, fill_max_y;
+
+    // Write combining: the color and depth written by a pixel are kept in a buffer holding one 32-bit VRAM word,
+    // which is written when the raster leaves the word and at the end of the triangle, so two neighbouring pixels
+    // take one write. The last depth word read is kept, so the next pixel reads its depth from it. The clears and the
+    // tile fills write 32-bit words, FB_WIDTH must be even.
+    logic [31:0] color_address, depth_address;          // of the pixel (x, y)
+    logic [31:0] color_write_address, depth_write_address;
+    logic [31:0] color_write_data, depth_write_data;
+    logic  [3:0] color_write_mask, depth_write_mask;    // 0 when the buffer is empty
+    logic        is_color_write_hit, is_depth_write_hit;
+    logic [31:0] depth_line_address;
+    logic [31:0] depth_line;
+    logic        depth_line_valid;
+    logic        is_depth_line_hit;
+    logic [15:0] vram_data_in;                          // half of vram_data_in_i at vram_addr_o
+
+    initial begin
+        for (int i = 0; i < NB_TILE_WORDS; i = i + 1) begin
+            depth_tile_flags[i] = 32'd0;
+            color_tile_flags[i] = 32'd0;
+        end
+    end
 
     //
     // Draw triangle
     //
 
-    logic is_textured, is_clamp_s, is_clamp_t, is_depth_test, is_perspective_correct;
+    logic is_textured, is_clamp_s, is_clamp_t, is_depth_test, is_perspective_correct, is_texture_swizzled;
+
+    logic [4:0] packed_index;
+
+    // Command prefetch: the vertex attributes are not used once a triangle is set up, so they are the second set of
+    // triangle parameters. While a triangle is rasterized, the OP_SET_* commands and the words of the next
+    // OP_DRAW_PACKED are loaded in them, and the next other command is kept until the raster ends. When it draws a
+    // triangle, the edge setup unit computes its bounding box, edge increments and inverse area meanwhile.
+    logic is_rasterizing;
+    logic is_command_pending;                           // command taken while rasterizing
+    logic is_packed_pending;                            // the pending command is an OP_DRAW_PACKED missing words
+    logic is_word_taken;                                // a stream word is taken in this cycle
+    logic is_packed_word;                               // the word is a vertex word of OP_DRAW_PACKED
+    logic is_attr_command;                              // the word is an OP_SET_* command
+
+    enum { EDGE_SETUP_IDLE, EDGE_SETUP0, EDGE_SETUP1, EDGE_SETUP_DONE } edge_setup_state;
+    logic               is_edge_setup_start;
+    logic signed [31:0] edge_setup_mul_p0[2], edge_setup_mul_p1[2];
+    logic signed [63:0] edge_setup_mul_z[2];
+    logic signed [11:0] next_min_x, next_min_y, next_max_x, next_max_y;
+    logic signed [31:0] next_e0_dx, next_e1_dx, next_e2_dx;
+    logic signed [31:0] next_e0_dy, next_e1_dy, next_e2_dy;
+    logic signed [31:0] next_inv_area;
 
     logic signed [31:0] p0, p1;
-    logic signed [31:0] w0, w1, w2;
+    logic signed [31:0] e0, e1, e2;                     // edge functions at the current pixel
+    logic signed [31:0] e0_row, e1_row, e2_row;         // edge functions at the start of the current row
+    logic signed [31:0] e0_dx, e1_dx, e2_dx;            // edge function increments along x
+    logic signed [31:0] e0_dy, e1_dy, e2_dy;            // edge function increments along y
     logic signed [31:0] inv_area;
-    logic signed [31:0] s, t;
-    logic signed [31:0] r, g, b;
+
+    // Triangle setup: the plane of an attribute is the sum of e_i * inv_area * a_i over the vertices, modulo 2^64.
+    // It is linear in x and y, so it is stepped like the edge functions and the pixels only add the gradients.
+    logic signed [31:0] attr_vertex[3][NB_ATTRIBUTES];
+    logic signed [63:0] ew[3], ew_dx[3], ew_dy[3];      // edge functions (at the first pixel) and increments * inv_area
+    logic signed [63:0] setup_ew[3];
+    logic        [63:0] plane[NB_ATTRIBUTES];           // planes at the current pixel
+    logic        [63:0] plane_row[NB_ATTRIBUTES];       // planes at the start of the current row
+    logic        [63:0] plane_dx[NB_ATTRIBUTES], plane_dy[NB_ATTRIBUTES];
+    logic        [63:0] plane_term;
+    logic         [2:0] setup_attr, setup_attr_q;
+    logic         [1:0] setup_term, setup_term_q;       // 0: plane at the first pixel, 1: x increment, 2: y increment
+    logic               setup_valid;
 
     logic signed [31:0] dsp_mul_p0[NB_DSP_MULS], dsp_mul_p1[NB_DSP_MULS];
     logic signed [63:0] dsp_mul_z[NB_DSP_MULS];
-
-    logic signed [31:0] t0, t1;
-    logic        [31:0] z;
-
-    logic        [15:0] depth;
-    logic        [15:0] sample;
+    logic signed [63:0] dsp_mul_p[NB_DSP_MULS];
+
+    // Fragment pipeline: the raster walks the bounding box one pixel per cycle and issues the covered pixels to the
+    // stages below, which hold one pixel each and pass it on every cycle unless they wait:
+    //   DT  depth test, waits for the depth word when it is not kept, and for the VRAM port to write the depth
+    //   RC  reciprocal of z for the perspective correction, RC_DEPTH stages moving together
+    //   PC  perspective correction
+    //   TC  texel coordinates
+    //   TF  texel fetch, waits for the line reads when the line kept does not hold the texel
+    //   TS  texel sample (palette of CLUT8, colors of BLOCK4)
+    //   CW  color modulation, the color goes to the write buffer
+    // A stage moves when it does not wait and the next one is empty or moves. The VRAM port goes to the last stage
+    // that needs it: CW, then TF, then DT. The pipeline is drained before a tile fill and at the end of the triangle.
+    logic               is_raster_done;                 // the last pixel of the bounding box is issued
+    logic               is_covered, is_tile_fill, is_pipeline_empty, is_raster_step;
+    logic               dt_valid, pc_valid, tc_valid, tf_valid, ts_valid, cw_valid;
+    logic               dt_move, rc_advance, rc_move, pc_move, tc_move, tf_move;
+    logic               dt_grant, tf_grant, cw_grant;
+
+    logic        [31:0] dt_z;
+    logic signed [31:0] dt_r, dt_g, dt_b, dt_s, dt_t;
+    logic        [31:0] dt_color_address, dt_depth_address;
+    logic               dt_read_pending;                // the depth word read in the previous cycle is on the port
+    logic        [31:0] dt_depth_word;
+    logic        [15:0] dt_depth;
+    logic               dt_has_depth, dt_pass, dt_flush;
+
+    // The stage 0 holds the pixel whose z is in reciprocal_x, the last one the pixel whose 1/z is in reciprocal_z
+    localparam RC_DEPTH = RECIPROCAL_LATENCY + 1;
+    logic [RC_DEPTH-1:0]        rc_valid;
+    logic [RC_DEPTH-1:0] [31:0] rc_r, rc_g, rc_b, rc_s, rc_t;
+    logic [RC_DEPTH-1:0] [31:0] rc_color_address;
+
+    logic signed [31:0] pc_r, pc_g, pc_b, pc_s, pc_t;
+    logic        [31:0] pc_color_address;
+
+    logic signed [31:0] tc_r, tc_g, tc_b, tc_s, tc_t;
+    logic        [31:0] tc_color_address;
+
+    logic signed [31:0] tf_r, tf_g, tf_b;
+    logic        [31:0] tf_color_address;
+    logic        [11:0] texel_x, texel_y;               // texel of TF
+    logic               is_texel_hit;
+    logic               texel_read_pending;             // the texel word read in the previous cycle is on the port
+
+    logic signed [31:0] ts_r, ts_g, ts_b;
+    logic        [31:0] ts_color_address;
+    logic        [47:0] ts_line;
+    logic               ts_texel_byte;                  // CLUT8 texel in the high byte of the word
+    logic         [1:0] ts_texel_x;
+    logic               ts_texel_y;
+
+    logic signed [31:0] cw_r, cw_g, cw_b;
+    logic        [31:0] cw_color_address;
+    logic        [15:0] cw_sample;
+    logic        [15:0] cw_color;
+    logic               cw_flush;
+
+    // Texture fetch: a line is the word holding a texel (ARGB4444 and CLUT8), or the 2 colors of its block and the
+    // word of its indices (BLOCK4). The last line read is kept, so the neighbouring texels of a triangle are read once.
+    logic        [31:0] texel_offset;                   // in texels, in the layout of the texture
+    logic        [31:0] texel_block_offset;             // BLOCK4 block, in words
+    logic        [31:0] texel_line_address;             // address of the last word of the line
+    logic        [31:0] texel_line_tag;
+    logic               texel_line_valid;
+    logic        [47:0] texel_line;                     // the words of the line, from the LSB
+    logic         [1:0] texel_word;                     // word of the line read next
 
     genvar dsp_mul_index;
     generate
@@ -107,251 +262,328 @@ module graphite #(
             dsp_mul dsp_mul(
                 .p0(dsp_mul_p0[dsp_mul_index]),
                 .p1(dsp_mul_p1[dsp_mul_index]),
-                .z(dsp_mul_z[dsp_mul_index])
+                .z(dsp_mul_z[dsp_mul_index]),
+                .p(dsp_mul_p[dsp_mul_index])
             );
         end
     endgenerate
 
+    always_comb begin
+        attr_vertex[0] = '{vv02, c00, c01, c02, st00, st01};
+        attr_vertex[1] = '{vv12, c10, c11, c12, st10, st11};
+        attr_vertex[2] = '{vv22, c20, c21, c22, st20, st21};
+
+        for (int i = 0; i < 3; i = i + 1)
+            setup_ew[i] = (setup_term == 2'd0) ? ew[i] : (setup_term == 2'd1) ? ew_dx[i] : ew_dy[i];
+    end
+
+    // The multipliers 2i and 2i + 1 compute the low 64 bits of setup_ew[i] * a_i from the low and high words of
+    // setup_ew[i]. The low word is signed in the multiplier, so its sign bit is carried into the high word.
+    assign plane_term = 64'(dsp_mul_p[0]) + {dsp_mul_p[1][31:0], 32'd0} +
+                        64'(dsp_mul_p[2]) + {dsp_mul_p[3][31:0], 32'd0} +
+                        64'(dsp_mul_p[4]) + {dsp_mul_p[5][31:0], 32'd0};
+
+    always_comb begin
+        texel_offset = is_texture_swizzled ? swizzle_texel(texel_x, texel_y, texture_width_scale, texture_height_scale)
+                                           : (32'(texel_y) << (5 + texture_width_scale)) + 32'(texel_x);
+        // 4 words per block of 4x4 texels, the swizzled texels of a block are consecutive
+        if (is_texture_swizzled)
+            texel_block_offset = (texel_offset & ~32'hF) >> 2;
+        else
+            texel_block_offset = (32'(texel_y >> 2) << (5 + texture_width_scale)) + 32'(texel_x & ~12'h3);
+        case (texture_format)
+            TEXTURE_FORMAT_CLUT8:
+                texel_line_address = texture_address + (texel_offset >> 1);
+            TEXTURE_FORMAT_BLOCK4:
+                // the indices of the rows 0 and 1, or 2 and 3, follow the 2 colors
+                texel_line_address = texture_address + texel_block_offset + 32'd2 + 32'(texel_y[1]);
+            default:
+                texel_line_address = texture_address + texel_offset;
+        endcase
+    end
+
     logic signed [11:0] min_x, min_y, max_x, max_y;
 
+    always_comb begin
+        color_address = fb_address + back_rel_address + raster_rel_address;
+        depth_address = fb_address + depth_rel_address + raster_rel_address;
+        is_color_write_hit = color_write_mask != 4'd0 && color_write_address[31:1] == cw_color_address[31:1];
+        is_depth_write_hit = depth_write_mask != 4'd0 && depth_write_address[31:1] == dt_depth_address[31:1];
+        is_depth_line_hit = depth_line_valid && depth_line_address[31:1] == dt_depth_address[31:1];
+        vram_data_in = vram_addr_o[0] ? vram_data_in_i[31:16] : vram_data_in_i[15:0];
+    end
+
+    always_comb begin
+        tile_index = 32'(y >>> TILE_SHIFT) * TILES_WIDTH + 32'(x >>> TILE_SHIFT);
+        is_tile_word_valid = !is_tile_word_stale && tile_read_word == tile_index >> 5;
+        is_depth_tile_cleared = depth_tile_word[tile_index[4:0]];
+        is_color_tile_cleared = color_tile_word[tile_index[4:0]];
+    end
+
+    always_ff @(posedge clk) begin
+        if (ce_i) begin
+            depth_tile_word <= depth_tile_flags[tile_index >> 5];
+            color_tile_word <= color_tile_flags[tile_index >> 5];
+            tile_read_word  <= tile_index >> 5;
+        end
+    end
+
+    always_comb begin
+        is_covered = !(e0[31] || e1[31] || e2[31]);
+        is_tile_fill = !is_raster_done && is_covered && is_tile_word_valid &&
+                       (is_depth_tile_cleared || is_color_tile_cleared);
+        is_pipeline_empty = !dt_valid && rc_valid == '0 && !pc_valid && !tc_valid && !tf_valid && !ts_valid &&
+                            !cw_valid;
+
+        // DT: the depth word is on the port, kept, or not needed
+        dt_depth_word = dt_read_pending ? vram_data_in_i : depth_line;
+        dt_depth = dt_depth_address[0] ? dt_depth_word[31:16] : dt_depth_word[15:0];
+        dt_has_depth = !is_depth_test || dt_read_pending || is_depth_line_hit;
+        dt_pass = !is_depth_test || 16'(dt_z) > dt_depth;
+        dt_flush = dt_has_depth && dt_pass && depth_write_mask != 4'd0 && !is_depth_write_hit;
+
+        is_texel_hit = !is_textured || (texel_line_valid && texel_line_address == texel_line_tag);
+
+        // CW: the sample is RGB444, modulated to RGB565
+        cw_flush = cw_valid && color_write_mask != 4'd0 && !is_color_write_hit;
+        cw_color = {5'(modulate({1'b0, cw_sample[11:8], cw_sample[11]}, cw_r)),
+                    modulate({cw_sample[7:4], cw_sample[7:6]}, cw_g),
+                    5'(modulate({1'b0, cw_sample[3:0], cw_sample[3]}, cw_b))};
+
+        cw_grant = cw_flush;
+        tf_grant = tf_valid && !is_texel_hit && !texel_read_pending && !cw_grant;
+        dt_grant = !cw_grant && !(tf_valid && !is_texel_hit && !texel_read_pending);
+
+        tf_move = tf_valid && is_texel_hit;
+        tc_move = tc_valid && (!tf_valid || tf_move);
+        pc_move = pc_valid && (!tc_valid || tc_move);
+        rc_move = rc_valid[RC_DEPTH-1] && (!pc_valid || pc_move);
+        rc_advance = !rc_valid[RC_DEPTH-1] || rc_move;
+        dt_move = dt_valid && dt_has_depth && (!dt_flush || dt_grant) && rc_advance;
+
+        is_raster_step = !is_raster_done && !is_tile_fill &&
+                         (!is_covered || (is_tile_word_valid && (!dt_valid || dt_move)));
+    end
+
+    // Pipelined, it moves with RC while rasterizing
     logic [31:0] reciprocal_x, reciprocal_z;
-    logic reciprocal_start, reciprocal_done;
-    reciprocal reciprocal(.clk(clk), .reset_i(reset_i), .start_i(reciprocal_start), .x_i(reciprocal_x), .z_o(reciprocal_z), .done_o(reciprocal_done));
-    
+    logic reciprocal_ce, reciprocal_start, reciprocal_done;
+    assign reciprocal_ce = ce_i && (state != DRAW_TRIANGLE12 || rc_advance);
+    reciprocal reciprocal(.clk(clk), .reset_i(reset_i), .ce_i(reciprocal_ce), .start_i(reciprocal_start),
+                          .x_i(reciprocal_x), .z_o(reciprocal_z), .done_o(reciprocal_done));
+
+    //
+    // Edge setup unit: DRAW_TRIANGLE00 to DRAW_TRIANGLE04 for the pending triangle, with its own multipliers and
+    // reciprocal. It does not access the VRAM, so it runs while the raster does. It is stalled with the rest of
+    // graphite by ce_i, as it reads the vertex attributes and its results are taken by the FSM.
+    //
+
+    logic [31:0] edge_setup_reciprocal_x, edge_setup_reciprocal_z;
+    logic edge_setup_reciprocal_start, edge_setup_reciprocal_done;
+    reciprocal edge_setup_reciprocal(.clk(clk), .reset_i(reset_i), .ce_i(ce_i),
+                                     .start_i(edge_setup_reciprocal_start), .x_i(edge_setup_reciprocal_x),
+                                     .z_o(edge_setup_reciprocal_z),
+                                     .done_o(edge_setup_reciprocal_done));
+
+    genvar edge_setup_mul_index;
+    generate
+        for (edge_setup_mul_index = 0; edge_setup_mul_index < 2; edge_setup_mul_index = edge_setup_mul_index + 1) begin
+            dsp_mul edge_setup_mul(
+                .p0(edge_setup_mul_p0[edge_setup_mul_index]),
+                .p1(edge_setup_mul_p1[edge_setup_mul_index]),
+                .z(edge_setup_mul_z[edge_setup_mul_index]),
+                .p()
+            );
+        end
+    endgenerate
+
+    // the pending command draws a triangle whose vertex attributes are all loaded
+    assign is_edge_setup_start = is_command_pending && !is_packed_pending &&
+                                 (command[OP_POS+:OP_SIZE] == OP_DRAW || command[OP_POS+:OP_SIZE] == OP_DRAW_PACKED);
+
+    always_ff @(posedge clk) begin
+        if (ce_i) case (edge_setup_state)
+            EDGE_SETUP_IDLE: begin
+                if (is_edge_setup_start) begin
+                    next_min_x <= max(min3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14)), 0);
+                    next_min_y <= max(min3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14)), 0);
+                    next_max_x <= min(max3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14)), FB_WIDTH - 1);
+                    next_max_y <= min(max3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14)), FB_HEIGHT - 1);
+
+                    // area = mul(vv20 - vv00, vv11 - vv01) - mul(vv21 - vv01, vv10 - vv00)
+                    edge_setup_mul_p0[0] <= (vv20 - vv00);
+                    edge_setup_mul_p1[0] <= (vv11 - vv01);
+                    edge_setup_mul_p0[1] <= (vv21 - vv01);
+                    edge_setup_mul_p1[1] <= (vv10 - vv00);
+
+                    next_e0_dx <= vv21 - vv11;
+                    next_e0_dy <= vv10 - vv20;
+                    next_e1_dx <= vv01 - vv21;
+                    next_e1_dy <= vv20 - vv00;
+                    next_e2_dx <= vv11 - vv01;
+                    next_e2_dy <= vv00 - vv10;
+                    edge_setup_state <= EDGE_SETUP0;
+                end
+            end
+
+            EDGE_SETUP0: begin
+                edge_setup_reciprocal_x <= edge_setup_mul_z[0][31:0] - edge_setup_mul_z[1][31:0];
+                edge_setup_reciprocal_start <= 1'b1;
+                edge_setup_state <= EDGE_SETUP1;
+            end
+
+            EDGE_SETUP1: begin
+                edge_setup_reciprocal_start <= 1'b0;
+                if (edge_setup_reciprocal_done) begin
+                    next_inv_area <= edge_setup_reciprocal_z;
+                    edge_setup_state <= EDGE_SETUP_DONE;
+                end
+            end
+
+            EDGE_SETUP_DONE: begin
+                // until DRAW_TRIANGLE03 takes the results
+                if (state == DRAW_TRIANGLE03)
+                    edge_setup_state <= EDGE_SETUP_IDLE;
+            end
+        endcase
+
+        if (reset_i) begin
+            edge_setup_state <= EDGE_SETUP_IDLE;
+            edge_setup_reciprocal_start <= 1'b0;
+        end
+    end
+
+    // Multiplications issued to the DSP multipliers, depth tests and covered pixels, reported by the simulation
+    // benchmark
+    logic [31:0] nb_dsp_muls;
+    logic [31:0] nb_depth_tests;
+    logic [31:0] nb_covered_pixels;
+
+    always_ff @(posedge clk) begin
+        if (reset_i) begin
+            nb_dsp_muls <= 32'd0;
+            nb_depth_tests <= 32'd0;
+            nb_covered_pixels <= 32'd0;
+        end else if (ce_i) begin
+            if (state == DRAW_TRIANGLE12 && dt_move && is_depth_test)
+                nb_depth_tests <= nb_depth_tests + 32'd1;
+            if (state == DRAW_TRIANGLE12 && is_raster_step && is_covered)
+                nb_covered_pixels <= nb_covered_pixels + 32'd1;
+            case (state)
+                DRAW_TRIANGLE01: nb_dsp_muls <= nb_dsp_muls + 32'd2;
+                // the area, computed by the edge setup unit
+                DRAW_TRIANGLE03: if (edge_setup_state == EDGE_SETUP_DONE) nb_dsp_muls <= nb_dsp_muls + 32'd2;
+                DRAW_TRIANGLE05, DRAW_TRIANGLE08: nb_dsp_muls <= nb_dsp_muls + 32'd6;
+                DRAW_TRIANGLE09: nb_dsp_muls <= nb_dsp_muls + 32'd3;
+                DRAW_TRIANGLE10: if (setup_attr != 3'(NB_ATTRIBUTES)) nb_dsp_muls <= nb_dsp_muls + 32'd6;
+                // perspective correction, texel coordinates and color modulation of the fragment pipeline
+                DRAW_TRIANGLE12: nb_dsp_muls <= nb_dsp_muls + ((rc_move && is_perspective_correct) ? 32'd5 : 32'd0) +
+                                                ((tc_move && is_textured) ? 32'd2 : 32'd0) +
+                                                (cw_valid ? 32'd3 : 32'd0);
+                default: ;
+            endcase
+        end
+    end
+
     assign p0 = {6'd0, x, 14'd0};
     assign p1 = {6'd0, y, 14'd0};
 
-    assign cmd_axis_tready_o = state == WAIT_COMMAND;
+    always_comb begin
+        case (state)
+            DRAW_TRIANGLE12:
+                is_rasterizing = 1'b1;
+            FILL_TILE0, FILL_TILE1:
+                is_rasterizing = !is_resolving;
+            default:
+                is_rasterizing = 1'b0;
+        endcase
+    end
+
+    assign is_packed_pending = is_command_pending && command[OP_POS+:OP_SIZE] == OP_DRAW_PACKED &&
+                               packed_index != 5'(NB_PACKED_WORDS);
+    assign cmd_axis_tready_o = state == WAIT_COMMAND || state == DRAW_PACKED0 ||
+                               (is_rasterizing && (!is_command_pending || is_packed_pending));
+    assign busy_o = state != WAIT_COMMAND;
+    assign is_word_taken = ce_i && cmd_axis_tvalid_i && cmd_axis_tready_o;
+    assign is_packed_word = state == DRAW_PACKED0 || is_packed_pending;
+    assign is_attr_command = cmd_axis_tdata_i[OP_POS+:OP_SIZE] <= 8'(OP_SET_T2);
 
     always_ff @(posedge clk) begin
         if (ce_i) case (state)
             WAIT_COMMAND: begin
                 swap_o <= 1'b0;
-                if (cmd_axis_tvalid_i)
+                // the OP_SET_* commands are taken without leaving the state
+                if (cmd_axis_tvalid_i && !is_attr_command) begin
+                    command <= cmd_axis_tdata_i;
+                    packed_index <= 5'd0;
                     state <= PROCESS_COMMAND;
+                end
             end
 
             PROCESS_COMMAND: begin
-                case (cmd_axis_tdata_i[OP_POS+:OP_SIZE])
-                    OP_SET_X0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv00[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv00[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Y0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv01[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv01[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Z0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv02[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv02[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_X1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv10[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv10[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Y1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv11[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv11[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Z1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv12[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv12[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_X2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv20[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv20[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Y2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv21[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv21[15:0] <= cmd_axis_tdata_i[15:0] & SUBPIXEL_PRECISION_MASK;
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_Z2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            vv22[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            vv22[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_R0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c00[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c00[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_G0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c01[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c01[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_B0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c02[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c02[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_R1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c10[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c10[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_G1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c11[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c11[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_B1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c12[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c12[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_R2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c20[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c20[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_G2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c21[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c21[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_B2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            c22[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            c22[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_S0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st00[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st00[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_T0: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st01[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st01[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_S1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st10[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st10[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_T1: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st11[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st11[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_S2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st20[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st20[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
-                    OP_SET_T2: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            st21[31:16] <= cmd_axis_tdata_i[15:0];
-                        end else begin
-                            st21[15:0] <= cmd_axis_tdata_i[15:0];
-                        end
-                        state <= WAIT_COMMAND;
-                    end
+                case (command[OP_POS+:OP_SIZE])
                     OP_CLEAR: begin
-                        vram_addr_o     <= fb_address + ((cmd_axis_tdata_i[16] == 0) ? back_rel_address : 32'(2 * FB_WIDTH * FB_HEIGHT));
-                        vram_data_out_o <= cmd_axis_tdata_i[15:0];
-                        clear_o         <= 1'b1;
-                        vram_mask_o     <= 4'hF;
-                        vram_sel_o      <= 1'b1;
-                        vram_wr_o       <= 1'b1;
-                        state           <= (cmd_axis_tdata_i[16] == 0) ? CLEAR_FB0 : CLEAR_DEPTH0;
+                        // The tiles are flagged by a fast clear, and unflagged before the buffer is written otherwise
+                        if (command[16])
+                            depth_clear_value <= command[15:0];
+                        else
+                            color_clear_value <= command[15:0];
+                        if (!command[16])
+                            is_color_resolve_pending <= command[17];
+                        is_depth_clear  <= command[16];
+                        is_fast_clear   <= command[17];
+                        tile_flags_sel  <= command[16] ? 2'b01 : 2'b10;
+                        tile_flags_value <= command[17];
+                        tile_word       <= 32'd0;
+                        state           <= CLEAR_TILES0;
                     end
                     OP_DRAW: begin
                         // Draw triangle
-                        is_textured            <= cmd_axis_tdata_i[0];
-                        is_clamp_t             <= cmd_axis_tdata_i[1];
-                        is_clamp_s             <= cmd_axis_tdata_i[2];
-                        is_depth_test          <= cmd_axis_tdata_i[3];
-                        is_perspective_correct <= cmd_axis_tdata_i[4];
-                        texture_width_scale    <= cmd_axis_tdata_i[7:5];
-                        texture_height_scale   <= cmd_axis_tdata_i[10:8];
-                        vram_mask_o     <= 4'hF;
+                        is_textured            <= command[0];
+                        is_clamp_t             <= command[1];
+                        is_clamp_s             <= command[2];
+                        is_depth_test          <= command[3];
+                        is_perspective_correct <= command[4];
+                        texture_width_scale    <= command[7:5];
+                        texture_height_scale   <= command[10:8];
+                        is_texture_swizzled    <= command[11];
+                        texture_format         <= command[13:12];
+                        texel_line_valid       <= 1'b0;
+                        depth_line_valid       <= 1'b0;
                         min_x <= min3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14));
                         min_y <= min3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14));
                         max_x <= max3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14));
                         max_y <= max3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14));
-                        state <= DRAW_TRIANGLE00;
+                        state <= (edge_setup_state != EDGE_SETUP_IDLE) ? DRAW_TRIANGLE03 : DRAW_TRIANGLE00;
+                    end
+                    OP_DRAW_PACKED: begin
+                        // Draw triangle, the vertex attributes follow
+                        is_textured            <= command[0];
+                        is_clamp_t             <= command[1];
+                        is_clamp_s             <= command[2];
+                        is_depth_test          <= command[3];
+                        is_perspective_correct <= command[4];
+                        texture_width_scale    <= command[7:5];
+                        texture_height_scale   <= command[10:8];
+                        is_texture_swizzled    <= command[11];
+                        texture_format         <= command[13:12];
+                        texel_line_valid       <= 1'b0;
+                        depth_line_valid       <= 1'b0;
+                        // the words may have been taken while the previous triangle was rasterized
+                        if (packed_index != 5'(NB_PACKED_WORDS))
+                            state <= DRAW_PACKED0;
+                        else
+                            state <= (edge_setup_state != EDGE_SETUP_IDLE) ? DRAW_TRIANGLE03 : DRAW_PACKED1;
                     end
                     OP_SWAP: begin
-                        if (vsync_i || !cmd_axis_tdata_i[0]) begin
+                        if (is_color_resolve_pending) begin
+                            // the command is processed again once the back buffer is resolved
+                            x            <= 12'd0;
+                            y            <= 12'd0;
+                            is_resolving <= 1'b1;
+                            vram_mask_o  <= 4'hF;
+                            state        <= RESOLVE_TILES0;
+                        end else if (vsync_i || !command[0]) begin
                             swap_o <= 1'b1;
                             front_rel_address <= back_rel_address;
                             back_rel_address  <= front_rel_address;
@@ -359,24 +591,34 @@ module graphite #(
                         end
                     end
                     OP_SET_TEX_ADDR: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            texture_address[31:16] <= cmd_axis_tdata_i[15:0];
-                            texture_write_address[31:16] <= cmd_axis_tdata_i[15:0];
+                        if (command[16]) begin
+                            texture_address[31:16] <= command[15:0];
+                            texture_write_address[31:16] <= command[15:0];
                         end else begin
-                            texture_address[15:0] <= cmd_axis_tdata_i[15:0];
-                            texture_write_address[15:0] <= cmd_axis_tdata_i[15:0];
+                            texture_address[15:0] <= command[15:0];
+                            texture_write_address[15:0] <= command[15:0];
                         end
                         state <= WAIT_COMMAND;
                     end
+                    OP_SET_PALETTE: begin
+                        palette[command[23:16]] <= command[15:0];
+                        state <= WAIT_COMMAND;
+                    end
                     OP_SET_FB_ADDR: begin
-                        if (cmd_axis_tdata_i[16]) begin
-                            fb_address[31:16] <= cmd_axis_tdata_i[15:0];
+                        if (command[16]) begin
+                            fb_address[31:16] <= command[15:0];
                         end else begin
-                            fb_address[15:0] <= cmd_axis_tdata_i[15:0];
+                            fb_address[15:0] <= command[15:0];
                         end
                         front_rel_address   <= 32'h0;
-                        back_rel_address    <= cmd_axis_tdata_i[17] ? 32'h0 : FB_WIDTH * FB_HEIGHT;
-                        state <= WAIT_COMMAND;
+                        back_rel_address    <= command[17] ? 32'h0 : FB_WIDTH * FB_HEIGHT;
+                        // the pending fast clears are dropped
+                        is_color_resolve_pending <= 1'b0;
+                        is_fast_clear    <= 1'b1;
+                        tile_flags_sel   <= 2'b11;
+                        tile_flags_value <= 1'b0;
+                        tile_word        <= 32'd0;
+                        state <= CLEAR_TILES0;
                     end
                     default:
                         state <= WAIT_COMMAND;
@@ -390,23 +632,119 @@ module graphite #(
             end
 
             CLEAR_FB0: begin
-                if (vram_addr_o < fb_address + back_rel_address + FB_WIDTH * FB_HEIGHT - 1) begin
-                    vram_addr_o <= vram_addr_o + 1;
+                if (vram_addr_o < fb_address + back_rel_address + FB_WIDTH * FB_HEIGHT - 2) begin
+                    vram_addr_o <= vram_addr_o + 2;
                 end else begin
                     clear_o     <= 1'b0;                    
+                    vram_sel_o  <= 1'b0;
+                    vram_wr_o   <= 1'b0;
                     state       <= WAIT_COMMAND;
                 end
             end
 
             CLEAR_DEPTH0: begin
-                if (vram_addr_o < fb_address + 3 * FB_WIDTH * FB_HEIGHT - 1) begin
-                    vram_addr_o <= vram_addr_o + 1;
+                if (vram_addr_o < fb_address + 3 * FB_WIDTH * FB_HEIGHT - 2) begin
+                    vram_addr_o <= vram_addr_o + 2;
                 end else begin
                     clear_o    <= 1'b0;                    
+                    vram_sel_o <= 1'b0;
+                    vram_wr_o  <= 1'b0;
                     state      <= WAIT_COMMAND;
                 end
             end
+
+            CLEAR_TILES0: begin
+                // One word of flags per cycle, then the buffer is written unless the clear is fast
+                if (tile_flags_sel[0])
+                    depth_tile_flags[tile_word] <= {32{tile_flags_value}};
+                if (tile_flags_sel[1])
+                    color_tile_flags[tile_word] <= {32{tile_flags_value}};
+                tile_word <= tile_word + 32'd1;
+                if (tile_word == NB_TILE_WORDS - 1) begin
+                    if (is_fast_clear) begin
+                        state <= WAIT_COMMAND;
+                    end else begin
+                        vram_addr_o     <= fb_address + (is_depth_clear ? depth_rel_address : back_rel_address);
+                        vram_data_out_o <= {2{is_depth_clear ? depth_clear_value : color_clear_value}};
+                        clear_o         <= 1'b1;
+                        vram_mask_o     <= 4'hF;
+                        vram_sel_o      <= 1'b1;
+                        vram_wr_o       <= 1'b1;
+                        state           <= is_depth_clear ? CLEAR_DEPTH0 : CLEAR_FB0;
+                    end
+                end
+            end
+
+            FILL_TILE0: begin
+                vram_addr_o     <= fb_address + (is_fill_depth ? depth_rel_address : back_rel_address) +
+                                   32'(fill_y) * FB_WIDTH + 32'(fill_x);
+                vram_data_out_o <= {2{is_fill_depth ? depth_clear_value : color_clear_value}};
+                vram_mask_o     <= 4'hF;
+                vram_sel_o      <= 1'b1;
+                vram_wr_o       <= 1'b1;
+                state           <= FILL_TILE1;
+            end
+
+            FILL_TILE1: begin
+                // Two pixels of the tile per cycle, then its flag is cleared and the pixel (x, y) is processed again
+                if (fill_x + 1 < fill_max_x) begin
+                    fill_x <= fill_x + 2;
+                    vram_addr_o <= vram_addr_o + 2;
+                end else if (fill_y < fill_max_y) begin
+                    fill_x <= fill_min_x;
+                    fill_y <= fill_y + 1;
+                    vram_addr_o <= vram_addr_o + 32'(FB_WIDTH) - 32'(fill_max_x - fill_min_x) + 1;
+                end else begin
+                    vram_sel_o <= 1'b0;
+                    vram_wr_o  <= 1'b0;
+                    if (is_fill_depth)
+                        depth_tile_flags[tile_index >> 5] <= depth_tile_word & ~(32'd1 << tile_index[4:0]);
+                    else
+                        color_tile_flags[tile_index >> 5] <= color_tile_word & ~(32'd1 << tile_index[4:0]);
+                    is_tile_word_stale <= 1'b1;
+                    state <= is_resolving ? RESOLVE_TILES0 : DRAW_TRIANGLE12;
+                end
+            end
+
+            RESOLVE_TILES0: begin
+                // The color tiles still flagged are filled, one tile per cycle otherwise
+                is_tile_word_stale <= 1'b0;
+                if (!is_tile_word_valid) begin
+                    // the flag word is read
+                end else if (is_color_tile_cleared) begin
+                    fill_x        <= x;
+                    fill_y        <= y;
+                    fill_min_x    <= x;
+                    fill_max_x    <= min(x + TILE_SIZE - 1, FB_WIDTH - 1);
+                    fill_max_y    <= min(y + TILE_SIZE - 1, FB_HEIGHT - 1);
+                    is_fill_depth <= 1'b0;
+                    state         <= FILL_TILE0;
+                end else if (x + TILE_SIZE < FB_WIDTH) begin
+                    x <= x + TILE_SIZE;
+                end else if (y + TILE_SIZE < FB_HEIGHT) begin
+                    x <= 12'd0;
+                    y <= y + TILE_SIZE;
+                end else begin
+                    is_color_resolve_pending <= 1'b0;
+                    is_resolving <= 1'b0;
+                    state <= PROCESS_COMMAND;
+                end
+            end
             
+            DRAW_PACKED0: begin
+                // the words are loaded with the OP_SET_* commands, below
+                if (cmd_axis_tvalid_i && packed_index == 5'(NB_PACKED_WORDS - 1))
+                    state <= DRAW_PACKED1;
+            end
+
+            DRAW_PACKED1: begin
+                min_x <= min3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14));
+                min_y <= min3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14));
+                max_x <= max3(12'(vv00 >> 14), 12'(vv10 >> 14), 12'(vv20 >> 14));
+                max_y <= max3(12'(vv01 >> 14), 12'(vv11 >> 14), 12'(vv21 >> 14));
+                state <= DRAW_TRIANGLE00;
+            end
+
             DRAW_TRIANGLE00: begin
                 min_x <= max(min_x, 0);
                 min_y <= max(min_y, 0);
@@ -425,6 +763,14 @@ module graphite #(
                 // t1 = mul(c1 - a1, b0 - a0)
                 dsp_mul_p0[1] <= (vv21 - vv01);
                 dsp_mul_p1[1] <= (vv10 - vv00);
+
+                // the edge functions are linear, mul(a + (1 << 14), b) = mul(a, b) + b
+                e0_dx <= vv21 - vv11;
+                e0_dy <= vv10 - vv20;
+                e1_dx <= vv01 - vv21;
+                e1_dy <= vv20 - vv00;
+                e2_dx <= vv11 - vv01;
+                e2_dy <= vv00 - vv10;
                 state <= DRAW_TRIANGLE02;
             end
 
@@ -434,6 +780,27 @@ module graphite #(
                 state <= DRAW_TRIANGLE04;
             end
 
+            DRAW_TRIANGLE03: begin
+                // Set up by the edge setup unit while the previous triangle was rasterized
+                if (edge_setup_state == EDGE_SETUP_DONE) begin
+                    min_x <= next_min_x;
+                    min_y <= next_min_y;
+                    max_x <= next_max_x;
+                    max_y <= next_max_y;
+                    e0_dx <= next_e0_dx;
+                    e0_dy <= next_e0_dy;
+                    e1_dx <= next_e1_dx;
+                    e1_dy <= next_e1_dy;
+                    e2_dx <= next_e2_dx;
+                    e2_dy <= next_e2_dy;
+                    inv_area <= next_inv_area;
+                    x <= next_min_x;
+                    y <= next_min_y;
+                    raster_rel_address <= {20'd0, next_min_y} * FB_WIDTH + {20'd0, next_min_x};
+                    state <= DRAW_TRIANGLE05;
+                end
+            end
+
             DRAW_TRIANGLE04: begin
                 reciprocal_start <= 1'b0;
                 if (reciprocal_done) begin
@@ -446,6 +813,8 @@ module graphite #(
             end
 
             DRAW_TRIANGLE05: begin
+                // Evaluate the edge functions at the first pixel, they are stepped afterwards
+
                 // w0 = edge_function(vv1, vv2, p);
                 // w0 = mul(c0 - a0, b1 - a1) - mul(c1 - a1, b0 - a0)
                 // t0 = mul(c0 - a0, b1 - a1)
@@ -477,314 +846,411 @@ module graphite #(
             end
 
             DRAW_TRIANGLE07: begin
-                w0 <= dsp_mul_z[0][31:0] - dsp_mul_z[1][31:0];
-                w1 <= dsp_mul_z[2][31:0] - dsp_mul_z[3][31:0];
-                w2 <= dsp_mul_z[4][31:0] - dsp_mul_z[5][31:0];
-                state <= DRAW_TRIANGLE12;
-            end
-
-            DRAW_TRIANGLE12: begin
-                // if w0 < 0, w1 < 0 or w2 < 0
-                if (w0[31] || w1[31] || w2[31]) begin
-                    state <= DRAW_TRIANGLE59;
-                end else begin
-                    // w0 = mul(w0, inv_area)
-                    dsp_mul_p0[0] <= w0;
-                    dsp_mul_p1[0] <= inv_area;
-                    // w1 = mul(w1, inv_area)
-                    dsp_mul_p0[1] <= w1;
-                    dsp_mul_p1[1] <= inv_area;
-                    // w2 = mul(w2, inv_area)
-                    dsp_mul_p0[2] <= w2;
-                    dsp_mul_p1[2] <= inv_area;
-                    state <= DRAW_TRIANGLE13;
-                end
-            end
-
-            DRAW_TRIANGLE13: begin
-                w0 <= dsp_mul_z[0][31:0] >> 8;
-                w1 <= dsp_mul_z[1][31:0] >> 8;
-                w2 <= dsp_mul_z[2][31:0] >> 8;
-                state <= DRAW_TRIANGLE15;
-            end
-
-            DRAW_TRIANGLE15: begin
-                // r = mul(w0, c00) + mul(w1, c10) + mul(w2, c20)
-                // t0 = mul(w0, c00)
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= c00;
-                // t1 = mul(w1, c10)
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= c10;
-                // t2 = mul(w2, c20)
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= c20;
-                state <= DRAW_TRIANGLE18;
+                e0 <= dsp_mul_z[0][31:0] - dsp_mul_z[1][31:0];
+                e1 <= dsp_mul_z[2][31:0] - dsp_mul_z[3][31:0];
+                e2 <= dsp_mul_z[4][31:0] - dsp_mul_z[5][31:0];
+                e0_row <= dsp_mul_z[0][31:0] - dsp_mul_z[1][31:0];
+                e1_row <= dsp_mul_z[2][31:0] - dsp_mul_z[3][31:0];
+                e2_row <= dsp_mul_z[4][31:0] - dsp_mul_z[5][31:0];
+                state <= DRAW_TRIANGLE08;
             end
 
-            DRAW_TRIANGLE18: begin
-                r <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                // g = mul(w0, c01) + mul(w1, c11) + mul(w2, c21)
-                // t0 = mul(w0, c01)
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= c01;
-                // t1 = mul(w1, c11)
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= c11;
-                // t2 = mul(w2, c21)
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= c21;
-                state <= DRAW_TRIANGLE21;
+            DRAW_TRIANGLE08: begin
+                // Triangle setup: edge functions and increments * inv_area
+                dsp_mul_p0[0] <= e0;
+                dsp_mul_p1[0] <= inv_area;
+                dsp_mul_p0[1] <= e1;
+                dsp_mul_p1[1] <= inv_area;
+                dsp_mul_p0[2] <= e2;
+                dsp_mul_p1[2] <= inv_area;
+                dsp_mul_p0[3] <= e0_dx;
+                dsp_mul_p1[3] <= inv_area;
+                dsp_mul_p0[4] <= e1_dx;
+                dsp_mul_p1[4] <= inv_area;
+                dsp_mul_p0[5] <= e2_dx;
+                dsp_mul_p1[5] <= inv_area;
+                state <= DRAW_TRIANGLE09;
             end
 
-            DRAW_TRIANGLE21: begin
-                g <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                // b = mul(w0, c02) + mul(w1, c12) + mul(w2, c22)
-                // t0 = mul(w0, c02)
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= c02;
-                // t1 = mul(w1, c12)
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= c12;
-                // t2 = mul(w2, c22)
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= c22;
-                state <= DRAW_TRIANGLE24;
+            DRAW_TRIANGLE09: begin
+                ew[0] <= dsp_mul_p[0];
+                ew[1] <= dsp_mul_p[1];
+                ew[2] <= dsp_mul_p[2];
+                ew_dx[0] <= dsp_mul_p[3];
+                ew_dx[1] <= dsp_mul_p[4];
+                ew_dx[2] <= dsp_mul_p[5];
+                dsp_mul_p0[0] <= e0_dy;
+                dsp_mul_p1[0] <= inv_area;
+                dsp_mul_p0[1] <= e1_dy;
+                dsp_mul_p1[1] <= inv_area;
+                dsp_mul_p0[2] <= e2_dy;
+                dsp_mul_p1[2] <= inv_area;
+                setup_attr <= 3'd0;
+                setup_term <= 2'd0;
+                setup_valid <= 1'b0;
+                state <= DRAW_TRIANGLE10;
             end
 
-            DRAW_TRIANGLE24: begin
-                b <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                if (is_textured) begin
-                    state <= DRAW_TRIANGLE25;
+            DRAW_TRIANGLE10: begin
+                if (!setup_valid) begin
+                    ew_dy[0] <= dsp_mul_p[0];
+                    ew_dy[1] <= dsp_mul_p[1];
+                    ew_dy[2] <= dsp_mul_p[2];
                 end else begin
-                    sample <= 16'hFFFF;
-                    state <= DRAW_TRIANGLE32;
+                    // plane term issued in the previous cycle
+                    case (setup_term_q)
+                        2'd0: begin
+                            plane[setup_attr_q] <= plane_term;
+                            plane_row[setup_attr_q] <= plane_term;
+                        end
+                        2'd1: plane_dx[setup_attr_q] <= plane_term;
+                        default: plane_dy[setup_attr_q] <= plane_term;
+                    endcase
                 end
-            end
-
-            DRAW_TRIANGLE25: begin
-                // s = mul(w0, st00) + mul(w1, st10) + mul(w2, st20)
-                // t0 = mul(w0, st00)
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= st00;
-                // t1 = mul(w1, st10)
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= st10;
-                // t2 = mul(w2, st20)
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= st20;
-                state <= DRAW_TRIANGLE28;
-            end
 
-            DRAW_TRIANGLE28: begin
-                s <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                // t = mul(w0, st01) + mul(w1, st11) + mul(w2, st21)
-                // t0 = mul(w0, st01)
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= st01;
-                // t1 = mul(w1, st11)
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= st11;
-                // t2 = mul(w2, st21)
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= st21;
-                state <= DRAW_TRIANGLE31;
-            end
-
-            DRAW_TRIANGLE31: begin
-                t <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                state <= DRAW_TRIANGLE32;
-            end
-
-            DRAW_TRIANGLE32: begin
-                // z = w0 * vv02 + w1 * vv12 + w2 * vv22
-                dsp_mul_p0[0] <= w0;
-                dsp_mul_p1[0] <= vv02;
-                dsp_mul_p0[1] <= w1;
-                dsp_mul_p1[1] <= vv12;
-                dsp_mul_p0[2] <= w2;
-                dsp_mul_p1[2] <= vv22;
-                state <= DRAW_TRIANGLE35;
-            end
-
-            DRAW_TRIANGLE35: begin
-                z <= dsp_mul_z[0][31:0] + dsp_mul_z[1][31:0] + dsp_mul_z[2][31:0];
-                vram_addr_o <= fb_address + depth_rel_address + 32'(y) * FB_WIDTH + 32'(x);
-                if (is_depth_test) begin
-                    vram_wr_o <= 1'b0;
-                    vram_sel_o <= 1'b1;
-                    state <= DRAW_TRIANGLE36;
+                if (setup_attr == 3'(NB_ATTRIBUTES)) begin
+                    is_raster_done <= 1'b0;
+                    state <= DRAW_TRIANGLE12;
                 end else begin
-                    state <= DRAW_TRIANGLE39;
+                    // one plane term per cycle, with two multipliers per vertex
+                    for (int i = 0; i < 3; i = i + 1) begin
+                        dsp_mul_p0[2 * i] <= setup_ew[i][31:0];
+                        dsp_mul_p1[2 * i] <= attr_vertex[i][setup_attr];
+                        dsp_mul_p0[2 * i + 1] <= setup_ew[i][63:32] + {31'd0, setup_ew[i][31]};
+                        dsp_mul_p1[2 * i + 1] <= attr_vertex[i][setup_attr];
+                    end
+                    setup_attr_q <= setup_attr;
+                    setup_term_q <= setup_term;
+                    setup_valid <= 1'b1;
+                    if (setup_term == 2'd2) begin
+                        setup_attr <= setup_attr + 3'd1;
+                        setup_term <= 2'd0;
+                    end else begin
+                        setup_term <= setup_term + 2'd1;
+                    end
                 end
             end
 
-            DRAW_TRIANGLE36: begin
+            DRAW_TRIANGLE12: begin
+                // Fragment pipeline, the stages are in reverse order since each one reads the stage before it
                 vram_sel_o <= 1'b0;
-                state <= DRAW_TRIANGLE37;
-            end
+                vram_wr_o  <= 1'b0;
+                is_tile_word_stale <= 1'b0;
+
+                // CW: the color goes to the write buffer, which is written first if it holds another word
+                if (cw_valid) begin
+                    if (cw_flush) begin
+                        vram_addr_o     <= color_write_address;
+                        vram_data_out_o <= color_write_data;
+                        vram_mask_o     <= color_write_mask;
+                        vram_sel_o      <= 1'b1;
+                        vram_wr_o       <= 1'b1;
+                    end
+                    color_write_address <= cw_color_address;
+                    color_write_data[16 * cw_color_address[0]+:16] <= cw_color;
+                    color_write_mask <= (is_color_write_hit ? color_write_mask : 4'd0) |
+                                        half_mask(cw_color_address[0]);
+                end
 
-            DRAW_TRIANGLE37: begin
-                depth <= 16'(vram_data_in_i);
-                state <= DRAW_TRIANGLE38;
-            end
+                // TS: sample of the texel, in RGB444
+                cw_valid <= ts_valid;
+                if (ts_valid) begin
+                    cw_r <= ts_r;
+                    cw_g <= ts_g;
+                    cw_b <= ts_b;
+                    cw_color_address <= ts_color_address;
+                    if (!is_textured)
+                        cw_sample <= 16'hFFFF;
+                    else if (texture_format == TEXTURE_FORMAT_CLUT8)
+                        cw_sample <= palette[ts_texel_byte ? ts_line[15:8] : ts_line[7:0]];
+                    else if (texture_format == TEXTURE_FORMAT_BLOCK4)
+                        cw_sample <= block4_texel(ts_line, ts_texel_x, ts_texel_y);
+                    else
+                        cw_sample <= ts_line[15:0];
+                end
 
-            DRAW_TRIANGLE38: begin
-                if (16'(z) > depth) begin
-                    state <= DRAW_TRIANGLE39;
-                end else begin
-                    state <= DRAW_TRIANGLE59;
+                // TF: the line of the texel is read unless it is kept, one word per cycle
+                ts_valid <= tf_move;
+                if (tf_move) begin
+                    ts_r <= tf_r;
+                    ts_g <= tf_g;
+                    ts_b <= tf_b;
+                    ts_color_address <= tf_color_address;
+                    ts_line <= texel_line;
+                    ts_texel_byte <= texel_offset[0];
+                    ts_texel_x <= texel_x[1:0];
+                    ts_texel_y <= texel_y[0];
+                end
+                if (texel_read_pending) begin
+                    texel_line[16 * texel_word+:16] <= vram_data_in;
+                    texel_read_pending <= 1'b0;
+                    if (texture_format == TEXTURE_FORMAT_BLOCK4 && texel_word != 2'd2) begin
+                        texel_word <= texel_word + 2'd1;
+                    end else begin
+                        texel_line_valid <= 1'b1;
+                        texel_word <= 2'd0;
+                    end
+                end
+                if (tf_grant) begin
+                    // BLOCK4: the 2 colors of the block, then the indices of the rows of the texel
+                    case (texel_word)
+                        2'd0: vram_addr_o <= (texture_format == TEXTURE_FORMAT_BLOCK4) ?
+                                             texture_address + texel_block_offset : texel_line_address;
+                        2'd1: vram_addr_o <= texture_address + texel_block_offset + 32'd1;
+                        default: vram_addr_o <= texel_line_tag;
+                    endcase
+                    vram_sel_o <= 1'b1;
+                    if (texel_word == 2'd0) begin
+                        texel_line_tag <= texel_line_address;
+                        texel_line_valid <= 1'b0;
+                    end
+                    texel_read_pending <= 1'b1;
                 end
-            end
 
-            DRAW_TRIANGLE39: begin
-                vram_data_out_o <= 16'(z);
-                vram_wr_o <= 1'b1;
-                vram_sel_o <= 1'b1;
-                state <= DRAW_TRIANGLE40;
-            end
+                // TC: texel coordinates
+                if (tc_move) begin
+                    tf_valid <= 1'b1;
+                    tf_r <= tc_r;
+                    tf_g <= tc_g;
+                    tf_b <= tc_b;
+                    tf_color_address <= tc_color_address;
+                    texel_x <= texel_coord(32'(TEXTURE_WIDTH) << texture_width_scale,
+                                           is_clamp_s ? clamp(tc_s) : wrap(tc_s));
+                    texel_y <= texel_coord(32'(TEXTURE_HEIGHT) << texture_height_scale,
+                                           is_clamp_t ? clamp(tc_t) : wrap(tc_t));
+                end else if (tf_move) begin
+                    tf_valid <= 1'b0;
+                end
 
-            DRAW_TRIANGLE40: begin
-                vram_sel_o <= 1'b0;
-                state <= DRAW_TRIANGLE41;
-            end
+                // PC: r, g, b, s and t * 1/z, multiplied since RC
+                if (pc_move) begin
+                    tc_valid <= 1'b1;
+                    if (is_perspective_correct) begin
+                        tc_r <= dsp_mul_z[0][31:0] >> 8;
+                        tc_g <= dsp_mul_z[1][31:0] >> 8;
+                        tc_b <= dsp_mul_z[2][31:0] >> 8;
+                        tc_s <= dsp_mul_z[3][31:0] >> 8;
+                        tc_t <= dsp_mul_z[4][31:0] >> 8;
+                    end else begin
+                        tc_r <= pc_r;
+                        tc_g <= pc_g;
+                        tc_b <= pc_b;
+                        tc_s <= pc_s;
+                        tc_t <= pc_t;
+                    end
+                    tc_color_address <= pc_color_address;
+                end else if (tc_move) begin
+                    tc_valid <= 1'b0;
+                end
 
-            DRAW_TRIANGLE41: begin
-                if (is_perspective_correct) begin
-                    // Perspective correction
-                    // r = r * 1/z
-                    // g = g * 1/z
-                    // b = b * 1/z
-                    // s = s * 1/z
-                    // t = t * 1/z
-                    reciprocal_x <= z << 12;
-                    reciprocal_start <= 1'b1;
-                    state <= DRAW_TRIANGLE42;
-                end else begin
-                    state <= DRAW_TRIANGLE48;
+                // RC: 1/z of the perspective correction, computed while the pixel moves through RC
+                if (rc_move) begin
+                    pc_valid <= 1'b1;
+                    pc_r <= rc_r[RC_DEPTH-1];
+                    pc_g <= rc_g[RC_DEPTH-1];
+                    pc_b <= rc_b[RC_DEPTH-1];
+                    pc_s <= rc_s[RC_DEPTH-1];
+                    pc_t <= rc_t[RC_DEPTH-1];
+                    pc_color_address <= rc_color_address[RC_DEPTH-1];
+                    dsp_mul_p0[0] <= rc_r[RC_DEPTH-1];
+                    dsp_mul_p0[1] <= rc_g[RC_DEPTH-1];
+                    dsp_mul_p0[2] <= rc_b[RC_DEPTH-1];
+                    dsp_mul_p0[3] <= rc_s[RC_DEPTH-1];
+                    dsp_mul_p0[4] <= rc_t[RC_DEPTH-1];
+                    for (int i = 0; i < 5; i = i + 1)
+                        dsp_mul_p1[i] <= reciprocal_z << 12;
+                end else if (pc_move) begin
+                    pc_valid <= 1'b0;
                 end
-            end
 
-            DRAW_TRIANGLE42: begin
-                reciprocal_start <= 1'b0;
-                if (reciprocal_done) begin
-                    dsp_mul_p0[0] <= r;
-                    dsp_mul_p1[0] <= (reciprocal_z << 12);
-                    dsp_mul_p0[1] <= g;
-                    dsp_mul_p1[1] <= (reciprocal_z << 12);
-                    dsp_mul_p0[2] <= b;
-                    dsp_mul_p1[2] <= (reciprocal_z << 12);
-                    dsp_mul_p0[3] <= s;
-                    dsp_mul_p1[3] <= (reciprocal_z << 12);
-                    dsp_mul_p0[4] <= t;
-                    dsp_mul_p1[4] <= (reciprocal_z << 12);
-                    state <= DRAW_TRIANGLE43;
+                // DT: the depth word is read unless it is kept, and the pixel is dropped if it fails the test
+                if (dt_read_pending) begin
+                    depth_line <= vram_data_in_i;
+                    depth_line_address <= dt_depth_address;
+                    depth_line_valid <= 1'b1;
+                    dt_read_pending <= 1'b0;
+                end
+                if (dt_valid && !dt_has_depth && dt_grant) begin
+                    vram_addr_o <= dt_depth_address;
+                    vram_sel_o <= 1'b1;
+                    dt_read_pending <= 1'b1;
+                end
+                if (rc_advance) begin
+                    rc_valid <= {rc_valid[RC_DEPTH-2:0], dt_move && dt_pass};
+                    rc_r <= {rc_r[RC_DEPTH-2:0], dt_r};
+                    rc_g <= {rc_g[RC_DEPTH-2:0], dt_g};
+                    rc_b <= {rc_b[RC_DEPTH-2:0], dt_b};
+                    rc_s <= {rc_s[RC_DEPTH-2:0], dt_s};
+                    rc_t <= {rc_t[RC_DEPTH-2:0], dt_t};
+                    rc_color_address <= {rc_color_address[RC_DEPTH-2:0], dt_color_address};
+                    reciprocal_x <= dt_z << 12;
+                    reciprocal_start <= dt_move && dt_pass && is_perspective_correct;
+                end
+                if (dt_move && dt_pass) begin
+                    // the depth goes to the write buffer, which is written first if it holds another word
+                    if (dt_flush) begin
+                        vram_addr_o     <= depth_write_address;
+                        vram_data_out_o <= depth_write_data;
+                        vram_mask_o     <= depth_write_mask;
+                        vram_wr_o       <= 1'b1;
+                        vram_sel_o      <= 1'b1;
+                    end
+                    depth_write_address <= dt_depth_address;
+                    depth_write_data[16 * dt_depth_address[0]+:16] <= 16'(dt_z);
+                    depth_write_mask <= (is_depth_write_hit ? depth_write_mask : 4'd0) |
+                                        half_mask(dt_depth_address[0]);
                 end
-            end
 
-            DRAW_TRIANGLE43: begin
-                r <= dsp_mul_z[0][31:0] >> 8;
-                g <= dsp_mul_z[1][31:0] >> 8;
-                b <= dsp_mul_z[2][31:0] >> 8;
-                s <= dsp_mul_z[3][31:0] >> 8;
-                t <= dsp_mul_z[4][31:0] >> 8;
-                state <= DRAW_TRIANGLE48;
+                // Raster: one pixel per cycle, a covered pixel waits until DT takes the previous one
+                if (is_raster_step && is_covered) begin
+                    dt_valid <= 1'b1;
+                    dt_z <= plane_value(plane[ATTR_Z]);
+                    dt_r <= plane_value(plane[ATTR_R]);
+                    dt_g <= plane_value(plane[ATTR_G]);
+                    dt_b <= plane_value(plane[ATTR_B]);
+                    dt_s <= plane_value(plane[ATTR_S]);
+                    dt_t <= plane_value(plane[ATTR_T]);
+                    dt_color_address <= color_address;
+                    dt_depth_address <= depth_address;
+                end else if (dt_move) begin
+                    dt_valid <= 1'b0;
+                end
+                if (is_raster_step) begin
+                    if (x < max_x) begin
+                        x <= x + 1;
+                        raster_rel_address <= raster_rel_address + 1;
+                        e0 <= e0 + e0_dx;
+                        e1 <= e1 + e1_dx;
+                        e2 <= e2 + e2_dx;
+                        for (int i = 0; i < NB_ATTRIBUTES; i = i + 1)
+                            plane[i] <= plane[i] + plane_dx[i];
+                    end else begin
+                        x <= min_x;
+                        y <= y + 1;
+                        raster_rel_address <= raster_rel_address + {20'd0, (FB_WIDTH[11:0] - max_x) + min_x};
+                        e0 <= e0_row + e0_dy;
+                        e1 <= e1_row + e1_dy;
+                        e2 <= e2_row + e2_dy;
+                        e0_row <= e0_row + e0_dy;
+                        e1_row <= e1_row + e1_dy;
+                        e2_row <= e2_row + e2_dy;
+                        for (int i = 0; i < NB_ATTRIBUTES; i = i + 1) begin
+                            plane[i] <= plane_row[i] + plane_dy[i];
+                            plane_row[i] <= plane_row[i] + plane_dy[i];
+                        end
+                        if (y >= max_y)
+                            is_raster_done <= 1'b1;
+                    end
+                end else if (is_tile_fill && is_pipeline_empty) begin
+                    // first pixel covered in a fast cleared tile, the tile is filled first (depth, then color)
+                    fill_x        <= x & ~12'(TILE_SIZE - 1);
+                    fill_y        <= y & ~12'(TILE_SIZE - 1);
+                    fill_min_x    <= x & ~12'(TILE_SIZE - 1);
+                    fill_max_x    <= min(x | 12'(TILE_SIZE - 1), FB_WIDTH - 1);
+                    fill_max_y    <= min(y | 12'(TILE_SIZE - 1), FB_HEIGHT - 1);
+                    is_fill_depth <= is_depth_tile_cleared;
+                    depth_line_valid <= 1'b0;
+                    state         <= FILL_TILE0;
+                end else if (is_raster_done && is_pipeline_empty) begin
+                    state <= FLUSH_WRITES0;
+                end
             end
 
-            DRAW_TRIANGLE48: begin
-                if (is_textured) begin
-                    state <= DRAW_TRIANGLE49;
+            FLUSH_WRITES0: begin
+                // The write buffers are written before the next command, one per cycle
+                if (color_write_mask != 4'd0) begin
+                    vram_addr_o     <= color_write_address;
+                    vram_data_out_o <= color_write_data;
+                    vram_mask_o     <= color_write_mask;
+                    vram_sel_o      <= 1'b1;
+                    vram_wr_o       <= 1'b1;
+                    color_write_mask <= 4'd0;
+                end else if (depth_write_mask != 4'd0) begin
+                    vram_addr_o     <= depth_write_address;
+                    vram_data_out_o <= depth_write_data;
+                    vram_mask_o     <= depth_write_mask;
+                    vram_sel_o      <= 1'b1;
+                    vram_wr_o       <= 1'b1;
+                    depth_write_mask <= 4'd0;
                 end else begin
-                    state <= DRAW_TRIANGLE54;
+                    vram_sel_o <= 1'b0;
+                    vram_wr_o  <= 1'b0;
+                    is_command_pending <= 1'b0;
+                    state      <= is_command_pending ? PROCESS_COMMAND : WAIT_COMMAND;
                 end
             end
+        endcase
 
-            DRAW_TRIANGLE49: begin
-                // y = mul((TEXTURE_HEIGHT - 1) << 14, clamp(t))
-                dsp_mul_p0[0] <= (((TEXTURE_HEIGHT << texture_height_scale) - 1) << 14);
-                dsp_mul_p1[0] <= (is_clamp_t ? clamp(t) : wrap(t));
-                // x = mul((TEXTURE_WIDTH - 1) << 14, clamp(s))
-                dsp_mul_p0[1] <= (((TEXTURE_WIDTH << texture_width_scale) - 1) << 14);
-                dsp_mul_p1[1] <= (is_clamp_s ? clamp(s) : wrap(s));
-                state <= DRAW_TRIANGLE51;
-            end
-
-            DRAW_TRIANGLE51: begin
-                dsp_mul_p0[0] <= dsp_mul_z[0][31:0] & 32'hFFFFC000;
-                dsp_mul_p1[0] <= (TEXTURE_WIDTH << texture_width_scale) << 14;
-                state <= DRAW_TRIANGLE52;
-            end
-
-            DRAW_TRIANGLE52: begin
-                vram_sel_o <= 1'b1;
-                vram_wr_o  <= 1'b0;
-                vram_addr_o <= texture_address + 32'(dsp_mul_z[0] >> 14) + 32'(dsp_mul_z[1] >> 14);
-                state <= DRAW_TRIANGLE53;
-            end
-
-            DRAW_TRIANGLE53: begin
-                vram_sel_o <= 1'b0;
-                sample <= vram_data_in_i;
-                state <= DRAW_TRIANGLE54;
-            end
-
-            DRAW_TRIANGLE54: begin
-                // Write RGB565 color to VRAM
-                // The sample is RGB444, so a conversion is required
-                dsp_mul_p0[0] <= {13'd0, sample[11:8], sample[11], 14'd0};
-                dsp_mul_p1[0] <= r;
-                state <= DRAW_TRIANGLE55;
-            end
-
-            DRAW_TRIANGLE55: begin
-                vram_data_out_o[15:11] <= 5'(dsp_mul_z[0][31:0] >> 14);
-                dsp_mul_p0[0] <= {12'd0, sample[7:4], sample[7:6], 14'd0};
-                dsp_mul_p1[0] <= g;
-                state <= DRAW_TRIANGLE56;
-            end
-
-            DRAW_TRIANGLE56: begin
-                vram_data_out_o[10:5] <= 6'(dsp_mul_z[0][31:0] >> 14);
-                dsp_mul_p0[0] <= {13'd0, sample[3:0], sample[3], 14'd0};
-                dsp_mul_p1[0] <= b;
-                state <= DRAW_TRIANGLE57;
-            end
-
-            DRAW_TRIANGLE57: begin
-                vram_data_out_o[4:0] <= 5'(dsp_mul_z[0][31:0] >> 14);
-                vram_sel_o <= 1'b1;
-                vram_wr_o  <= 1'b1;
-                vram_addr_o <= fb_address + back_rel_address + raster_rel_address;
-                state <= DRAW_TRIANGLE58;
-            end
-
-            DRAW_TRIANGLE58: begin
-                state <= DRAW_TRIANGLE59;
-                vram_sel_o <= 1'b0;
-                vram_wr_o  <= 1'b0;
-            end
+        // Stream words taken while rasterizing: a command other than OP_SET_* is pending until the raster ends
+        if (is_word_taken && is_rasterizing && !is_packed_pending && !is_attr_command) begin
+            command <= cmd_axis_tdata_i;
+            packed_index <= 5'd0;
+            is_command_pending <= 1'b1;
+        end
 
-            DRAW_TRIANGLE59: begin
-                if (x < max_x) begin
-                    x <= x + 1;
-                    raster_rel_address <= raster_rel_address + 1;
-                end else begin
-                    x <= min_x;
-                    y <= y + 1;
-                    raster_rel_address <= raster_rel_address + {20'd0, (FB_WIDTH[11:0] - max_x) + min_x};
+        // Vertex attributes, from the words of OP_DRAW_PACKED and the OP_SET_* commands
+        if (is_word_taken && is_packed_word) begin
+            case (packed_index)
+                5'd0: begin
+                    vv00 <= unpack_xy(cmd_axis_tdata_i[15:0]) & PACKED_XY_MASK;
+                    vv01 <= unpack_xy(cmd_axis_tdata_i[31:16]) & PACKED_XY_MASK;
                 end
-
-                state <= DRAW_TRIANGLE60;
-            end
-
-            DRAW_TRIANGLE60: begin
-                if (y > max_y) begin
-                    state       <= WAIT_COMMAND;
-                end else begin
-                    state       <= DRAW_TRIANGLE05;
+                5'd1: vv02 <= cmd_axis_tdata_i;
+                5'd2: st00 <= cmd_axis_tdata_i;
+                5'd3: st01 <= cmd_axis_tdata_i;
+                5'd4: c00 <= cmd_axis_tdata_i;
+                5'd5: c01 <= cmd_axis_tdata_i;
+                5'd6: c02 <= cmd_axis_tdata_i;
+                5'd7: begin
+                    vv10 <= unpack_xy(cmd_axis_tdata_i[15:0]) & PACKED_XY_MASK;
+                    vv11 <= unpack_xy(cmd_axis_tdata_i[31:16]) & PACKED_XY_MASK;
                 end
-            end
-        endcase
+                5'd8: vv12 <= cmd_axis_tdata_i;
+                5'd9: st10 <= cmd_axis_tdata_i;
+                5'd10: st11 <= cmd_axis_tdata_i;
+                5'd11: c10 <= cmd_axis_tdata_i;
+                5'd12: c11 <= cmd_axis_tdata_i;
+                5'd13: c12 <= cmd_axis_tdata_i;
+                5'd14: begin
+                    vv20 <= unpack_xy(cmd_axis_tdata_i[15:0]) & PACKED_XY_MASK;
+                    vv21 <= unpack_xy(cmd_axis_tdata_i[31:16]) & PACKED_XY_MASK;
+                end
+                5'd15: vv22 <= cmd_axis_tdata_i;
+                5'd16: st20 <= cmd_axis_tdata_i;
+                5'd17: st21 <= cmd_axis_tdata_i;
+                5'd18: c20 <= cmd_axis_tdata_i;
+                5'd19: c21 <= cmd_axis_tdata_i;
+                default: c22 <= cmd_axis_tdata_i;
+            endcase
+            packed_index <= packed_index + 5'd1;
+        end else if (is_word_taken && is_attr_command) begin
+            case (cmd_axis_tdata_i[OP_POS+:OP_SIZE])
+                OP_SET_X0: vv00 <= set_half(vv00, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Y0: vv01 <= set_half(vv01, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Z0: vv02 <= set_half(vv02, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_X1: vv10 <= set_half(vv10, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Y1: vv11 <= set_half(vv11, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Z1: vv12 <= set_half(vv12, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_X2: vv20 <= set_half(vv20, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Y2: vv21 <= set_half(vv21, cmd_axis_tdata_i[23:0], SUBPIXEL_PRECISION_MASK);
+                OP_SET_Z2: vv22 <= set_half(vv22, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_R0: c00 <= set_half(c00, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_G0: c01 <= set_half(c01, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_B0: c02 <= set_half(c02, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_R1: c10 <= set_half(c10, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_G1: c11 <= set_half(c11, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_B1: c12 <= set_half(c12, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_R2: c20 <= set_half(c20, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_G2: c21 <= set_half(c21, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_B2: c22 <= set_half(c22, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_S0: st00 <= set_half(st00, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_T0: st01 <= set_half(st01, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_S1: st10 <= set_half(st10, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_T1: st11 <= set_half(st11, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                OP_SET_S2: st20 <= set_half(st20, cmd_axis_tdata_i[23:0], 16'hFFFF);
+                default: st21 <= set_half(st21, cmd_axis_tdata_i[23:0], 16'hFFFF);
+            endcase
+        end
 
         if (reset_i) begin
             swap_o              <= 1'b0;
@@ -800,6 +1266,26 @@ module graphite #(
             reciprocal_start    <= 1'b0;
             texture_width_scale <= 3'd0;
             texture_height_scale <= 3'd0;
+            is_texture_swizzled <= 1'b0;
+            texture_format      <= TEXTURE_FORMAT_ARGB4444;
+            texel_line_valid    <= 1'b0;
+            is_color_resolve_pending <= 1'b0;
+            is_resolving        <= 1'b0;
+            is_tile_word_stale  <= 1'b0;
+            color_write_mask    <= 4'd0;
+            depth_write_mask    <= 4'd0;
+            depth_line_valid    <= 1'b0;
+            is_command_pending  <= 1'b0;
+            dt_valid            <= 1'b0;
+            rc_valid            <= '0;
+            pc_valid            <= 1'b0;
+            tc_valid            <= 1'b0;
+            tf_valid            <= 1'b0;
+            ts_valid            <= 1'b0;
+            cw_valid            <= 1'b0;
+            dt_read_pending     <= 1'b0;
+            texel_read_pending  <= 1'b0;
+            texel_word          <= 2'd0;
         end
     end
 
@@ -1,33 +1,107 @@
 `include "graphite.svh"
 
-// f(x) = NUMERATOR/x
-module reciprocal #(
-    parameter NUMERATOR = 32'h100
-)(
+// f(x) = 256/x in 18.14, i.e. (256 << 14 << 7) / (x >> 7), and 256 << 14 if x >> 7 is 0. The seed of 1/x comes from a
+// table in BRAM and is refined by two Newton-Raphson iterations, then the quotient is corrected with its remainder, so
+// the result is the exact quotient. One x per cycle, the result is RECIPROCAL_LATENCY cycles after start_i. ce_i stalls
+// all the stages. sw_reciprocal() in ref_impl/sw_fragment_shader.h is the same computation.
+module reciprocal(
     input wire logic clk,
     input wire logic reset_i,
+    input wire logic ce_i,
     input wire logic start_i,
     input wire logic [31:0] x_i,
     output     logic [31:0] z_o,
     output     logic        done_o
 );
 
-    logic div_dbz;
-    logic [31:0] div_val;
-    assign z_o = div_dbz ? NUMERATOR << 14 : div_val;
-
-    div div(
-        .clk(clk),
-        .reset_i(reset_i),
-        .start_i(start_i),
-        .busy_o(),
-        .done_o(done_o),
-        .valid_o(),
-        .dbz_o(div_dbz),
-        .a_i(NUMERATOR << 14 << 7),
-        .b_i(x_i >> 7),
-        .val_o(div_val),
-        .rem_o()
-    );
-
-endmodule
\ No newline at end of file
+    localparam NUMERATOR = 32'h100 << 14 << 7;
+
+    // Seeds of 1/f for f in [1, 2), 1 + 10 bits of f, in 1.16: round(2^26 / (1024 + i + 0.5))
+    logic [15:0] seeds[1024];
+
+    initial begin
+        for (int i = 0; i < 1024; i = i + 1)
+            seeds[i] = 16'(((1 << 27) + (2049 + 2 * i) / 2) / (2049 + 2 * i));
+    end
+
+    logic [RECIPROCAL_LATENCY-2:0] valid;
+
+    // d = x >> 7 and its leading one p, dn = d << (24 - p) is f in 1.24
+    logic [24:0] d, dn;
+    logic  [4:0] p;
+    always_comb begin
+        d = 25'(x_i >> 7);
+        p = 5'd0;
+        for (int i = 0; i < 25; i = i + 1)
+            if (d[i])
+                p = 5'(i);
+        dn = d << (5'd24 - p);
+    end
+
+    // The fields of each stage
+    logic [24:0] d1, d2, d3, d4, d5, d6, d7, d8;
+    logic [24:0] dn1, dn2, dn3, dn4;
+    logic  [4:0] p1, p2, p3, p4, p5, p6;
+    logic [15:0] s2, s3;                // seed, 1.16
+    logic [40:0] u3;                    // 2 - f * seed, 2.40
+    logic [31:0] r4, r5;                // 1/f after one iteration, 0.32
+    logic [18:0] w5;                    // (1 - f * r) << 40
+    logic [31:0] r6;                    // 1/f after two iterations, 0.32
+    logic [31:0] q7, q8;                // quotient, at most 1 below the exact one
+    logic [31:0] rem8;
+
+    always_ff @(posedge clk) begin
+        if (ce_i) begin
+            valid <= {valid[RECIPROCAL_LATENCY-3:0], start_i};
+            done_o <= valid[RECIPROCAL_LATENCY-2];
+
+            d1 <= d;
+            dn1 <= dn;
+            p1 <= p;
+
+            s2 <= seeds[dn1[23:14]];
+            d2 <= d1;
+            dn2 <= dn1;
+            p2 <= p1;
+
+            u3 <= 41'((42'd1 << 41) - 42'(dn2) * 42'(s2));
+            s3 <= s2;
+            d3 <= d2;
+            dn3 <= dn2;
+            p3 <= p2;
+
+            r4 <= 32'((57'(s3) * 57'(u3)) >> 24);
+            d4 <= d3;
+            dn4 <= dn3;
+            p4 <= p3;
+
+            w5 <= 19'(((57'd1 << 56) - 57'(dn4) * 57'(r4)) >> 16);
+            r5 <= r4;
+            d5 <= d4;
+            p5 <= p4;
+
+            r6 <= r5 + 32'((51'(r5) * 51'(w5)) >> 40);
+            d6 <= d5;
+            p6 <= p5;
+
+            // 256 << 21 / d = (2^56 / dn) >> (p + 3)
+            q7 <= r6 >> (p6 + 5'd3);
+            d7 <= d6;
+
+            rem8 <= 32'(NUMERATOR) - q7 * 32'(d7);
+            q8 <= q7;
+            d8 <= d7;
+
+            if (d8 == 25'd0)
+                z_o <= 32'h100 << 14;
+            else
+                z_o <= (rem8 >= 32'(d8)) ? q8 + 32'd1 : q8;
+        end
+
+        if (reset_i) begin
+            valid <= '0;
+            done_o <= 1'b0;
+        end
+    end
+
+endmodule
@@ -9,14 +9,19 @@
 #include <fcntl.h>
 #include <graphite.h>
 #include <string.h>
+#include <sw_fragment_shader.h>
 #include <teapot.h>
 #include <termios.h>
 #include <unistd.h>
 #include <verilated.h>
 
+#include <algorithm>
 #include <deque>
 #include <iostream>
 #include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 
 #define FB_WIDTH 320
 #define FB_HEIGHT 240
@@ -52,6 +57,13 @@
 #define OP_SWAP 26
 #define OP_SET_TEX_ADDR 27
 #define OP_SET_FB_ADDR 28
+#define OP_DRAW_PACKED 29
+#define OP_SET_PALETTE 30
+
+#define CLEAR_COLOR 0x31A6
+
+#define BENCHMARK_NB_FRAMES 4
+#define BENCHMARK_CLOCK_HZ  40000000    // graphite runs on the CPU clock in the SoC (default speed)
 
 #if FIXED_POINT
 #define PARAM(x) (x)
@@ -63,9 +75,10 @@ extern uint16_t tex64x64[];
 extern uint16_t tex32x32[];
 extern uint16_t tex32x64[];
 extern uint16_t tex256x2048[];
-uint16_t *tex = tex256x2048;
+// tex, also sampled by the reference rasterizer, is defined in ref_impl/sw_fragment_shader.c
 #define TEXTURE_WIDTH 256
 #define TEXTURE_HEIGHT 2048
+#define TEXTURE_NB_LEVELS 4         // 256x2048 down to 32x256, see texture_nb_levels()
 
 // Serial
 
@@ -131,6 +144,32 @@ struct Command {
 };
 
 std::deque<Command> g_commands;
+bool g_packed_commands = true;
+size_t g_nb_triangles = 0;
+size_t g_nb_scanned_pixels = 0;     // pixels of the triangle bounding boxes, visited by the rasterizer
+size_t g_nb_level_triangles[TEXTURE_NB_LEVELS];     // textured triangles drawn from each mipmap level
+bool g_swizzled_texture = false;    // texture uploaded in the layout of texture_swizzled_offset()
+int g_texture_level = 0;            // mipmap level at the texture address of graphite
+int g_texture_format = TEXTURE_FORMAT_ARGB4444;
+bool g_fast_clear = false;          // OP_CLEAR bit 17, the tiles are cleared when they are first drawn to
+std::vector<uint16_t> g_ref_frame;  // frame of the standard rasterizer of ref_impl, drawn with graphite if not empty
+
+// SDRAM row activity of the VRAM accesses, with the address layout of soc/rtl/sdram.v: {bank (2), row (13), column (9)}
+// in 16-bit words. The frame buffers, the depth buffer and the texture are all in bank 0.
+struct VramStats {
+    uint64_t nb_row_misses;             // accesses to another row than the open row of their bank
+    uint64_t nb_texture_reads;
+    uint64_t nb_texture_row_misses;     // texture reads in another row than the previous texture read
+    uint64_t nb_words_touched;          // distinct texture words read
+    uint64_t nb_reads, nb_writes;       // VRAM transactions, of one 32-bit word
+    uint64_t nb_depth_reads;
+    uint64_t nb_halves_written;         // 16-bit halves written by the write transactions
+};
+
+VramStats g_vram_stats;
+uint32_t g_open_rows[4] = {UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX};
+uint32_t g_texture_row = UINT32_MAX;
+std::vector<bool> g_is_word_touched;
 
 void pulse_clk(Vtop* top) {
     top->contextp()->timeInc(1);
@@ -142,17 +181,93 @@ void pulse_clk(Vtop* top) {
     top->eval();
 }
 
+// Same bounding box as the rasterizer
+static size_t nb_scanned_pixels(vec3d p[3]) {
+    int min_x = std::max(std::min({INT(p[0].x), INT(p[1].x), INT(p[2].x)}), 0);
+    int min_y = std::max(std::min({INT(p[0].y), INT(p[1].y), INT(p[2].y)}), 0);
+    int max_x = std::min(std::max({INT(p[0].x), INT(p[1].x), INT(p[2].x)}), FB_WIDTH - 1);
+    int max_y = std::min(std::max({INT(p[0].y), INT(p[1].y), INT(p[2].y)}), FB_HEIGHT - 1);
+    return (max_x >= min_x && max_y >= min_y) ? (size_t)(max_x - min_x + 1) * (max_y - min_y + 1) : 1;
+}
+
 static void swap(fx32* a, fx32* b) {
     fx32 c = *a;
     *a = *b;
     *b = c;
 }
 
+static void push_word(uint32_t w) {
+    Command cmd;
+    cmd.opcode = w >> 24;
+    cmd.param = w & 0xFFFFFF;
+    g_commands.push_back(cmd);
+}
+
+// Screen coordinates are packed with 2 fractional bits, which is the subpixel precision of the rasterizer
+static uint32_t pack_xy(vec3d* p) {
+    return ((uint32_t)(PARAM(p->y) >> 12) << 16) | ((uint32_t)(PARAM(p->x) >> 12) & 0xFFFF);
+}
+
+#define TEXTURE_ADDRESS (3 * FB_WIDTH * FB_HEIGHT)
+
+static void set_texture_address(uint32_t address) {
+    Command cmd;
+    cmd.opcode = OP_SET_TEX_ADDR;
+    cmd.param = address & 0xFFFF;
+    g_commands.push_back(cmd);
+    cmd.param = 0x10000 | (address >> 16);
+    g_commands.push_back(cmd);
+}
+
 void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y,
-                      bool depth_test, bool perspective_correct)                      
+                      int texture_level, bool depth_test, bool perspective_correct)
 {
     struct Command cmd;
 
+    if (!g_ref_frame.empty()) {
+        sw_draw_triangle_standard(p[0].x, p[0].y, t[0].w, t[0].u, t[0].v, c[0].x, c[0].y, c[0].z, c[0].w,
+                                  p[1].x, p[1].y, t[1].w, t[1].u, t[1].v, c[1].x, c[1].y, c[1].z, c[1].w,
+                                  p[2].x, p[2].y, t[2].w, t[2].u, t[2].v, c[2].x, c[2].y, c[2].z, c[2].w,
+                                  tex != NULL, texture_level, clamp_s, clamp_t, depth_test, perspective_correct);
+    }
+
+    // the texture scales are the ones of the level
+    if (tex != NULL && texture_level != g_texture_level) {
+        uint32_t level_offset = texture_level_offset(TEXTURE_WIDTH, TEXTURE_HEIGHT, texture_level);
+        set_texture_address(TEXTURE_ADDRESS + texture_format_size(g_texture_format, level_offset));
+        g_texture_level = texture_level;
+    }
+
+    uint32_t draw_param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
+              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
+
+    draw_param |= texture_scale_x << 5;
+    draw_param |= texture_scale_y << 8;
+    draw_param |= g_swizzled_texture ? 1 << 11 : 0;
+    draw_param |= g_texture_format << 12;
+
+    g_nb_triangles++;
+    g_nb_scanned_pixels += nb_scanned_pixels(p);
+    if (tex != NULL)
+        g_nb_level_triangles[texture_level]++;
+
+    if (g_packed_commands) {
+        cmd.opcode = OP_DRAW_PACKED;
+        cmd.param = draw_param;
+        g_commands.push_back(cmd);
+
+        for (int i = 0; i < 3; ++i) {
+            push_word(pack_xy(&p[i]));
+            push_word(PARAM(t[i].w));
+            push_word(PARAM(t[i].u));
+            push_word(PARAM(t[i].v));
+            push_word(PARAM(c[i].x));
+            push_word(PARAM(c[i].y));
+            push_word(PARAM(c[i].z));
+        }
+        return;
+    }
+
     cmd.opcode = OP_SET_X0;
     cmd.param = PARAM(p[0].x) & 0xFFFF;
     g_commands.push_back(cmd);
@@ -298,26 +413,26 @@ void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool c
     g_commands.push_back(cmd);
 
     cmd.opcode = OP_DRAW;
-
-    cmd.param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
-              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
-
-    cmd.param |= texture_scale_x << 5;
-    cmd.param |= texture_scale_y << 8;
-
+    cmd.param = draw_param;
     g_commands.push_back(cmd);
 }
 
 void clear() {
     Command cmd;
+    uint32_t fast_clear = g_fast_clear ? 0x020000 : 0;
     // Clear framebuffer
     cmd.opcode = OP_CLEAR;
-    cmd.param = 0x0031A6;
+    cmd.param = fast_clear | CLEAR_COLOR;
     g_commands.push_back(cmd);
     // Clear depth buffer
     cmd.opcode = OP_CLEAR;
-    cmd.param = 0x010000;
+    cmd.param = fast_clear | 0x010000;
     g_commands.push_back(cmd);
+
+    if (!g_ref_frame.empty()) {
+        std::fill(g_ref_frame.begin(), g_ref_frame.end(), CLEAR_COLOR);
+        sw_clear_depth_buffer_standard();
+    }
 }
 
 void swap() {
@@ -334,13 +449,409 @@ void send_command(const char* s) {
     g_commands.push_back(c);
 }
 
+#define TEXTURE_SIZE texture_level_offset(TEXTURE_WIDTH, TEXTURE_HEIGHT, TEXTURE_NB_LEVELS)
+
+// Uploads the texture and its mipmaps in the current layout and format, then sets the palette of a CLUT8 texture and
+// the texture address of the level 0
 void write_texture(uint16_t* vram) {
-    uint32_t tex_addr = 3 * FB_WIDTH * FB_HEIGHT;
-    memcpy(vram + tex_addr, tex, TEXTURE_WIDTH*TEXTURE_HEIGHT*2);
+    std::vector<uint16_t> texels(TEXTURE_SIZE);
+    memcpy(texels.data(), tex, TEXTURE_WIDTH*TEXTURE_HEIGHT*2);
+    texture_generate_mipmaps(texels.data(), TEXTURE_WIDTH, TEXTURE_HEIGHT, TEXTURE_NB_LEVELS);
+
+    // the palette is shared by the levels
+    std::vector<uint8_t> indices(TEXTURE_SIZE);
+    if (g_texture_format == TEXTURE_FORMAT_CLUT8) {
+        uint16_t palette[256];
+        texture_quantize_clut8(texels.data(), TEXTURE_SIZE, palette, indices.data());
+        for (int i = 0; i < 256; ++i) {
+            Command cmd;
+            cmd.opcode = OP_SET_PALETTE;
+            cmd.param = (i << 16) | palette[i];
+            g_commands.push_back(cmd);
+        }
+    }
+
+    // the CLUT8 texels are bytes, the low byte of a word first
+    uint8_t* vram_bytes = (uint8_t*)&vram[TEXTURE_ADDRESS];
+    for (int level = 0; level < TEXTURE_NB_LEVELS; ++level) {
+        uint32_t width = TEXTURE_WIDTH >> level, height = TEXTURE_HEIGHT >> level;
+        uint32_t offset = texture_level_offset(TEXTURE_WIDTH, TEXTURE_HEIGHT, level);
+        if (g_texture_format == TEXTURE_FORMAT_BLOCK4) {
+            texture_encode_block4(&texels[offset], width, height, g_swizzled_texture,
+                                  &vram[TEXTURE_ADDRESS + texture_format_size(g_texture_format, offset)]);
+            continue;
+        }
+        for (uint32_t y = 0; y < height; ++y)
+            for (uint32_t x = 0; x < width; ++x) {
+                uint32_t texel = g_swizzled_texture ? texture_swizzled_offset(x, y, width, height) : y * width + x;
+                if (g_texture_format == TEXTURE_FORMAT_CLUT8)
+                    vram_bytes[offset + texel] = indices[offset + y * width + x];
+                else
+                    vram[TEXTURE_ADDRESS + offset + texel] = texels[offset + y * width + x];
+            }
+    }
+
+    set_texture_address(TEXTURE_ADDRESS);
+    g_texture_level = 0;
+}
+
+static void update_vram_stats(Vtop* top) {
+    uint32_t bank = (top->vram_addr_o >> 22) & 3;
+    uint32_t row = top->vram_addr_o >> 9;
+    if (g_open_rows[bank] != row) {
+        g_open_rows[bank] = row;
+        g_vram_stats.nb_row_misses++;
+    }
+    if (top->vram_wr_o) {
+        g_vram_stats.nb_writes++;
+        g_vram_stats.nb_halves_written += ((top->vram_mask_o & 0x3) != 0) + ((top->vram_mask_o & 0xC) != 0);
+    } else {
+        g_vram_stats.nb_reads++;
+        if (top->vram_addr_o >= 2 * FB_WIDTH * FB_HEIGHT && top->vram_addr_o < 3 * FB_WIDTH * FB_HEIGHT)
+            g_vram_stats.nb_depth_reads++;
+    }
+    if (!top->vram_wr_o && top->vram_addr_o >= TEXTURE_ADDRESS && top->vram_addr_o < TEXTURE_ADDRESS + TEXTURE_SIZE) {
+        g_vram_stats.nb_texture_reads++;
+        if (g_is_word_touched.size() > 0 && !g_is_word_touched[top->vram_addr_o - TEXTURE_ADDRESS]) {
+            g_is_word_touched[top->vram_addr_o - TEXTURE_ADDRESS] = true;
+            g_vram_stats.nb_words_touched++;
+        }
+        if (g_texture_row != row) {
+            g_texture_row = row;
+            g_vram_stats.nb_texture_row_misses++;
+        }
+    }
+}
+
+// A transaction accesses the 32-bit word holding the address, the even address in the low half
+static void update_vram(Vtop* top, uint16_t* vram_data) {
+    if (top->vram_sel_o) {
+        update_vram_stats(top);
+        uint32_t addr = top->vram_addr_o & ~1u;
+        if (addr < VRAM_SIZE) {
+            if (top->vram_wr_o) {
+                if (top->vram_mask_o & 0x3) vram_data[addr] = top->vram_data_out_o & 0xFFFF;
+                if (top->vram_mask_o & 0xC) vram_data[addr + 1] = top->vram_data_out_o >> 16;
+            }
+            top->vram_data_in_i = vram_data[addr] | ((uint32_t)vram_data[addr + 1] << 16);
+        } else {
+            top->vram_data_in_i = 0xF800F800;
+        }
+    }
+}
+
+// Overlap of the command prefetch with the raster, over the commands run
+struct OverlapStats {
+    uint64_t nb_words, nb_raster_words;                 // stream words taken, and while rasterizing
+    uint64_t nb_setup_cycles, nb_raster_setup_cycles;   // cycles of the edge setup unit, and while rasterizing
+};
+
+OverlapStats g_overlap_stats;
+
+uint64_t g_nb_raster_cycles;
+
+// Executes one clock cycle, with the next queued word on the stream. Returns true if the word is taken.
+static bool step_commands(Vtop* top, uint16_t* vram_data) {
+    bool is_taken = false;
+    if (top->cmd_axis_tready_o && g_commands.size() > 0) {
+        auto c = g_commands.front();
+        g_commands.pop_front();
+        top->cmd_axis_tdata_i = (c.opcode << 24) | c.param;
+        top->cmd_axis_tvalid_i = 1;
+        is_taken = true;
+    }
+    g_overlap_stats.nb_words += is_taken;
+    g_overlap_stats.nb_raster_words += is_taken && top->rasterizing_o;
+    g_overlap_stats.nb_setup_cycles += top->edge_setup_busy_o;
+    g_overlap_stats.nb_raster_setup_cycles += top->edge_setup_busy_o && top->rasterizing_o;
+    g_nb_raster_cycles += top->rasterizing_o;
+    update_vram(top, vram_data);
+    pulse_clk(top);
+    top->cmd_axis_tvalid_i = 0;
+    return is_taken;
+}
+
+// Execute the queued commands back to back, returns the number of clock cycles
+static uint64_t run_commands(Vtop* top, uint16_t* vram_data) {
+    uint64_t nb_cycles = 0;
+    // the stream is ready while the last triangle is rasterized
+    while (g_commands.size() > 0 || top->busy_o) {
+        step_commands(top, vram_data);
+        nb_cycles++;
+    }
+    return nb_cycles;
+}
+
+// Cycle trace of the queued commands, one column per cycle from the first cycle traced: the stream words taken (W),
+// the cycles of the edge setup unit (S) and the raster (R). The commands are then run to the end.
+static void trace_commands(Vtop* top, uint16_t* vram_data, uint64_t first_cycle, uint64_t nb_cycles) {
+    const size_t width = 100;
+    std::string rows[3];
+    for (uint64_t cycle = 0; cycle < first_cycle + nb_cycles && (g_commands.size() > 0 || top->busy_o); ++cycle) {
+        bool is_setup = top->edge_setup_busy_o, is_raster = top->rasterizing_o;
+        bool is_taken = step_commands(top, vram_data);
+        if (cycle >= first_cycle) {
+            rows[0] += is_taken ? 'W' : '.';
+            rows[1] += is_setup ? 'S' : '.';
+            rows[2] += is_raster ? 'R' : '.';
+        }
+    }
+    for (size_t pos = 0; pos < rows[0].size(); pos += width) {
+        printf("trace %8llu stream %s\n", (unsigned long long)(first_cycle + pos), rows[0].substr(pos, width).c_str());
+        printf("trace %8llu setup  %s\n", (unsigned long long)(first_cycle + pos), rows[1].substr(pos, width).c_str());
+        printf("trace %8llu raster %s\n", (unsigned long long)(first_cycle + pos), rows[2].substr(pos, width).c_str());
+    }
+    run_commands(top, vram_data);
+}
+
+// Largest difference of the red, green and blue components of two RGB565 pixels
+static int color_difference(uint16_t a, uint16_t b) {
+    int r = abs((a >> 11) - (b >> 11));
+    int g = abs(((a >> 5) & 0x3F) - ((b >> 5) & 0x3F));
+    int bl = abs((a & 0x1F) - (b & 0x1F));
+    return std::max(r, std::max(g, bl));
+}
+
+static void print_draw_stats(const char* name, const draw_stats_t& stats) {
+    printf("%s: %u faces, %u culled, %u near clipped, %u triangles offscreen, %u screen clipped, %u emitted, "
+           "%u degenerate, %u bounding box pixels, %u per light\n",
+           name, stats.nb_faces, stats.nb_faces_culled, stats.nb_faces_near_clipped, stats.nb_triangles_offscreen,
+           stats.nb_triangles_screen_clipped, stats.nb_triangles_emitted, stats.nb_triangles_degenerate,
+           stats.nb_bounding_box_pixels, stats.nb_light_bounding_box_pixels);
+}
+
+// Queues the benchmark frames: the textured teapot at the given scale, optionally cleared and swapped
+static void draw_benchmark_frames(model_t* model, float scale, bool is_cleared = false) {
+    mat4x4 mat_proj = matrix_make_projection(FB_WIDTH, FB_HEIGHT, 60.0f);
+    mat4x4 mat_view = matrix_make_identity();
+    vec3d vec_camera = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
+    texture_t dummy_texture;
+
+    for (int frame = 0; frame < BENCHMARK_NB_FRAMES; ++frame) {
+        if (is_cleared) clear();
+        float theta = 0.5f + 0.1f * frame;
+        mat4x4 mat_rot_z = matrix_make_rotation_z(theta);
+        mat4x4 mat_rot_x = matrix_make_rotation_x(theta);
+        mat4x4 mat_scale = matrix_make_scale(FX(scale), FX(scale), FX(scale));
+        mat4x4 mat_trans = matrix_make_translation(FX(0.0f), FX(0.0f), FX(2.0f));
+        mat4x4 mat_world = matrix_multiply_matrix(&mat_rot_z, &mat_rot_x);
+        mat_world = matrix_multiply_matrix(&mat_world, &mat_scale);
+        mat_world = matrix_multiply_matrix(&mat_world, &mat_trans);
+        draw_model(FB_WIDTH, FB_HEIGHT, &vec_camera, model, &mat_world, NULL, &mat_proj, &mat_view, NULL, 0,
+                   false, &dummy_texture, false, false, 3, 6, true);
+        if (is_cleared) swap();
+    }
+}
+
+// Command throughput benchmark, draws the teapot with both command formats. The small scale makes the
+// triangles cover a few pixels so that the command transfer and triangle setup dominate. Then the texel fetch
+// bandwidth and the SDRAM row misses of the linear and swizzled texture layouts, without and with mipmaps, and of the
+// CLUT8 and BLOCK4 texture formats. Last, the cycles saved by the fast clear.
+// The VRAM transactions are compared with the 16-bit accesses they replace: the writes combined by the write buffers
+// of graphite and the depth tests reading the depth word kept from the previous pixel.
+// The stream words and the edge setup cycles of the next triangle that overlap the raster of the current one are
+// counted, and a cycle trace of the small teapot shows them. Last, the covered pixels per cycle of the fragment
+// pipeline on the cube and the teapot, and their last frame compared with the one of the standard rasterizer of
+// ref_impl drawn from the same triangles.
+static void benchmark(Vtop* top, uint16_t* vram_data) {
+    model_t* model = load_teapot();
+
+    write_texture(vram_data);
+
+    const float scales[] = {1.0f, 0.1f};
+    for (float scale : scales) {
+        double unpacked_words_per_triangle = 0.0, unpacked_triangles_per_cycle = 0.0;
+        for (int packed = 0; packed < 2; ++packed) {
+            g_packed_commands = packed;
+            g_nb_triangles = 0;
+            g_nb_scanned_pixels = 0;
+
+            draw_stats_t draw_stats = {};
+            set_draw_stats(&draw_stats);
+            draw_benchmark_frames(model, scale);
+            set_draw_stats(NULL);
+
+            size_t nb_words = g_commands.size();
+            uint32_t nb_dsp_muls = top->nb_dsp_muls_o;
+            uint32_t nb_depth_tests = top->nb_depth_tests_o;
+            g_vram_stats = {};
+            g_overlap_stats = {};
+            uint64_t nb_cycles = run_commands(top, vram_data);
+            nb_dsp_muls = top->nb_dsp_muls_o - nb_dsp_muls;
+            nb_depth_tests = top->nb_depth_tests_o - nb_depth_tests;
+            printf("%-8s scale %.1f: %zu triangles, %.1f words/triangle, %.1f cycles/triangle, %.0f triangles/s at %d MHz\n",
+                   packed ? "packed" : "unpacked", scale, g_nb_triangles, (double)nb_words / g_nb_triangles,
+                   (double)nb_cycles / g_nb_triangles, (double)g_nb_triangles * BENCHMARK_CLOCK_HZ / nb_cycles,
+                   BENCHMARK_CLOCK_HZ / 1000000);
+            printf("%-8s scale %.1f: %zu pixels scanned, %.2f cycles/pixel\n", packed ? "packed" : "unpacked", scale,
+                   g_nb_scanned_pixels, (double)nb_cycles / g_nb_scanned_pixels);
+            printf("%-8s scale %.1f: %u DSP multiplications, %.1f/triangle, %.2f/pixel\n", packed ? "packed" : "unpacked",
+                   scale, nb_dsp_muls, (double)nb_dsp_muls / g_nb_triangles, (double)nb_dsp_muls / g_nb_scanned_pixels);
+            // without the write buffers and the depth words kept, each 16-bit access is a transaction
+            const VramStats& stats = g_vram_stats;
+            uint64_t nb_transactions = stats.nb_reads + stats.nb_writes;
+            uint64_t nb_accesses = stats.nb_reads - stats.nb_depth_reads + nb_depth_tests + stats.nb_halves_written;
+            printf("%-8s scale %.1f: %llu VRAM transactions (%llu reads, %llu writes), %llu 16-bit accesses, "
+                   "%.1f%% fewer transactions, %.1f%% bus occupancy\n",
+                   packed ? "packed" : "unpacked", scale, (unsigned long long)nb_transactions,
+                   (unsigned long long)stats.nb_reads, (unsigned long long)stats.nb_writes,
+                   (unsigned long long)nb_accesses,
+                   100.0 - 100.0 * nb_transactions / std::max<uint64_t>(nb_accesses, 1),
+                   100.0 * nb_transactions / nb_cycles);
+            printf("%-8s scale %.1f: %llu VRAM writes, %llu without the write buffers, %.1f%% fewer writes\n",
+                   packed ? "packed" : "unpacked", scale, (unsigned long long)stats.nb_writes,
+                   (unsigned long long)stats.nb_halves_written,
+                   100.0 - 100.0 * stats.nb_writes / std::max<uint64_t>(stats.nb_halves_written, 1));
+            const OverlapStats& overlap = g_overlap_stats;
+            printf("%-8s scale %.1f: %.1f%% of the stream words and %.1f%% of the edge setup cycles while "
+                   "rasterizing\n", packed ? "packed" : "unpacked", scale,
+                   100.0 * overlap.nb_raster_words / std::max<uint64_t>(overlap.nb_words, 1),
+                   100.0 * overlap.nb_raster_setup_cycles / std::max<uint64_t>(overlap.nb_setup_cycles, 1));
+            char name[32];
+            snprintf(name, sizeof(name), "%-8s scale %.1f", packed ? "packed" : "unpacked", scale);
+            print_draw_stats(name, draw_stats);
+            // the unpacked run is first
+            double words_per_triangle = (double)nb_words / g_nb_triangles;
+            double triangles_per_cycle = (double)g_nb_triangles / nb_cycles;
+            if (packed) {
+                printf("packed   scale %.1f: %.2fx fewer words/triangle, %.2fx the triangles/s of the unpacked "
+                       "commands\n", scale, unpacked_words_per_triangle / words_per_triangle,
+                       triangles_per_cycle / unpacked_triangles_per_cycle);
+            } else {
+                unpacked_words_per_triangle = words_per_triangle;
+                unpacked_triangles_per_cycle = triangles_per_cycle;
+            }
+        }
+    }
+
+    // the triangles of the small teapot, once the first ones are drawn
+    g_packed_commands = true;
+    draw_benchmark_frames(model, 0.1f);
+    trace_commands(top, vram_data, 2000, 400);
+
+    struct TextureConfig {
+        const char* name;
+        bool swizzled, mipmaps;
+        int format;
+    };
+    const TextureConfig configs[] = {
+        {"linear", false, false, TEXTURE_FORMAT_ARGB4444},
+        {"swizzled", true, false, TEXTURE_FORMAT_ARGB4444},
+        {"linear, mipmaps", false, true, TEXTURE_FORMAT_ARGB4444},
+        {"swizzled, mipmaps", true, true, TEXTURE_FORMAT_ARGB4444},
+        {"swizzled, mipmaps, clut8", true, true, TEXTURE_FORMAT_CLUT8},
+        {"swizzled, mipmaps, block4", true, true, TEXTURE_FORMAT_BLOCK4},
+    };
+    uint64_t nb_linear_row_misses = 0;     // of the first config
+    for (const TextureConfig& config : configs) {
+        set_texture_nb_levels(config.mipmaps ? TEXTURE_NB_LEVELS : 1);
+        g_swizzled_texture = config.swizzled;
+        g_texture_format = config.format;
+        write_texture(vram_data);
+        std::fill(std::begin(g_nb_level_triangles), std::end(g_nb_level_triangles), 0);
+        draw_benchmark_frames(model, 1.0f);
+
+        g_vram_stats = {};
+        g_is_word_touched.assign(TEXTURE_SIZE, false);
+        uint64_t nb_cycles = run_commands(top, vram_data);
+        const VramStats& stats = g_vram_stats;
+        printf("%-25s texture: %llu reads (%.1f MB/s at %d MHz), %llu distinct words (%.1f KB), %.1f reads/word\n",
+               config.name, (unsigned long long)stats.nb_texture_reads,
+               2.0 * stats.nb_texture_reads * BENCHMARK_CLOCK_HZ / nb_cycles / 1e6, BENCHMARK_CLOCK_HZ / 1000000,
+               (unsigned long long)stats.nb_words_touched, 2.0 * stats.nb_words_touched / 1024,
+               (double)stats.nb_texture_reads / std::max<uint64_t>(stats.nb_words_touched, 1));
+        printf("%-25s texture: %llu texture row misses (%.1f%%), %llu SDRAM row misses, %llu cycles\n", config.name,
+               (unsigned long long)stats.nb_texture_row_misses,
+               100.0 * stats.nb_texture_row_misses / std::max<uint64_t>(stats.nb_texture_reads, 1),
+               (unsigned long long)stats.nb_row_misses, (unsigned long long)nb_cycles);
+        uint32_t nb_texels = texture_level_offset(TEXTURE_WIDTH, TEXTURE_HEIGHT, config.mipmaps ? TEXTURE_NB_LEVELS : 1);
+        printf("%-25s texture: %.0f KB in VRAM\n", config.name,
+               2.0 * texture_format_size(config.format, nb_texels) / 1024);
+        if (config.mipmaps) {
+            printf("%-25s texture: triangles per mipmap level", config.name);
+            for (size_t nb_triangles : g_nb_level_triangles)
+                printf(" %zu", nb_triangles);
+            printf("\n");
+        }
+        if (&config == &configs[0]) {
+            nb_linear_row_misses = stats.nb_texture_row_misses;
+        } else {
+            printf("%-25s texture: %.1f%% fewer texture row misses than linear\n", config.name,
+                   100.0 - 100.0 * stats.nb_texture_row_misses / std::max<uint64_t>(nb_linear_row_misses, 1));
+        }
+    }
+    g_is_word_touched.clear();
+    g_swizzled_texture = false;
+    g_texture_format = TEXTURE_FORMAT_ARGB4444;
+    set_texture_nb_levels(1);
+    write_texture(vram_data);
+
+    // the last frame displayed must be the same with both clears
+    uint64_t nb_full_clear_cycles = 0;
+    std::vector<uint16_t> full_clear_frame;
+    for (int fast_clear = 0; fast_clear < 2; ++fast_clear) {
+        g_fast_clear = fast_clear;
+        draw_benchmark_frames(model, 1.0f, true);
+        uint64_t nb_cycles = run_commands(top, vram_data);
+        const uint16_t* front = &vram_data[top->front_addr_o];
+        std::vector<uint16_t> frame(front, front + FB_WIDTH * FB_HEIGHT);
+        printf("%-5s clear: %.0f cycles/frame", fast_clear ? "fast" : "full", (double)nb_cycles / BENCHMARK_NB_FRAMES);
+        if (fast_clear) {
+            printf(", %.0f cycles/frame saved (%.1f%%), frames %s\n",
+                   ((double)nb_full_clear_cycles - nb_cycles) / BENCHMARK_NB_FRAMES,
+                   100.0 * ((double)nb_full_clear_cycles - nb_cycles) / nb_full_clear_cycles,
+                   frame == full_clear_frame ? "identical" : "DIFFERENT");
+        } else {
+            printf("\n");
+            nb_full_clear_cycles = nb_cycles;
+            full_clear_frame = frame;
+        }
+    }
+    g_fast_clear = false;
+
+    // the raster cycles include the stalls of the pipeline and the tile fills
+    model_t* cube = load_cube();
+    const std::pair<const char*, model_t*> pipeline_models[] = {{"cube", cube}, {"teapot", model}};
+    for (const auto& pipeline_model : pipeline_models) {
+        draw_benchmark_frames(pipeline_model.second, 1.0f);
+        uint32_t nb_covered_pixels = top->nb_covered_pixels_o;
+        g_nb_raster_cycles = 0;
+        uint64_t nb_cycles = run_commands(top, vram_data);
+        nb_covered_pixels = top->nb_covered_pixels_o - nb_covered_pixels;
+        printf("%-6s pipeline: %u covered pixels, %.3f pixels/cycle, %.3f pixels/raster cycle\n",
+               pipeline_model.first, nb_covered_pixels, (double)nb_covered_pixels / nb_cycles,
+               (double)nb_covered_pixels / std::max<uint64_t>(g_nb_raster_cycles, 1));
+    }
+
+    // the frames are cleared so that the last one only has its own triangles
+    g_ref_frame.assign(FB_WIDTH * FB_HEIGHT, CLEAR_COLOR);
+    sw_init_rasterizer_standard(FB_WIDTH, FB_HEIGHT, g_ref_frame.data());
+    for (const auto& pipeline_model : pipeline_models) {
+        draw_benchmark_frames(pipeline_model.second, 1.0f, true);
+        uint32_t nb_covered_pixels = top->nb_covered_pixels_o;
+        uint64_t nb_cycles = run_commands(top, vram_data);
+        nb_covered_pixels = top->nb_covered_pixels_o - nb_covered_pixels;
+        const uint16_t* front = &vram_data[top->front_addr_o];
+        size_t nb_different_pixels = 0;
+        int max_difference = 0;
+        for (size_t i = 0; i < g_ref_frame.size(); ++i) {
+            if (front[i] != g_ref_frame[i]) {
+                nb_different_pixels++;
+                max_difference = std::max(max_difference, color_difference(front[i], g_ref_frame[i]));
+            }
+        }
+        printf("%-6s frame: %zu pixels different from ref_impl (%.2f%%), largest component difference %d, "
+               "%.3f pixels/cycle with the clears\n", pipeline_model.first, nb_different_pixels,
+               100.0 * nb_different_pixels / g_ref_frame.size(), max_difference,
+               (double)nb_covered_pixels / nb_cycles);
+    }
+    sw_dispose_rasterizer_standard();
+    g_ref_frame.clear();
 }
 
 int main(int argc, char** argv, char** env) {
-    if (argc > 1) {
+    bool is_benchmark = argc > 1 && strcmp(argv[1], "--benchmark") == 0;
+    if (argc > 1 && !is_benchmark) {
         g_serial_fd = open(argv[1], O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK);
         if (g_serial_fd < 0) {
             printf("error %d opening %s: %s", errno, argv[1], strerror(errno));
@@ -350,6 +861,25 @@ int main(int argc, char** argv, char** env) {
         set_blocking(g_serial_fd, 0);
     }
 
+    if (is_benchmark) {
+        const std::unique_ptr<VerilatedContext> contextp{new VerilatedContext};
+        Vtop* top = new Vtop{contextp.get(), "TOP"};
+        uint16_t* vram_data = new uint16_t[VRAM_SIZE]();
+
+        top->clk = 0;
+        top->eval();
+        top->reset_i = 1;
+        pulse_clk(top);
+        top->reset_i = 0;
+
+        benchmark(top, vram_data);
+
+        top->final();
+        delete top;
+        delete[] vram_data;
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window* window = SDL_CreateWindow("Graphite", SDL_WINDOWPOS_UNDEFINED_DISPLAY(1), SDL_WINDOWPOS_UNDEFINED,
@@ -390,6 +920,9 @@ int main(int argc, char** argv, char** env) {
     // Projection matrix
     mat4x4 mat_proj = matrix_make_projection(FB_WIDTH, FB_HEIGHT, 60.0f);
 
+    // the rasterizer only scans the on-screen part of triangles, let it handle the ones crossing the screen edges
+    set_guard_band(256);
+
     bool anim = false;
     bool wireframe = false;
     size_t nb_lights = 0;
@@ -399,6 +932,9 @@ int main(int argc, char** argv, char** env) {
     bool clamp_t = false;
     bool perspective_correct = true;
     bool show_depth = false;
+    bool packed_commands = true;
+    bool mipmaps = false;
+    bool print_stats = false;
 
     light_t lights[5];
     lights[0].direction = {FX(0.0f), FX(0.0f), FX(1.0f), FX(0.0f)};
@@ -466,11 +1002,18 @@ int main(int argc, char** argv, char** env) {
                 texture_dirty = false;
             }
 
+            // the serial dump uses the 24-bit parameter commands
+            g_packed_commands = packed_commands && !dump;
+
             if (current_model) {
                 // Draw cube
                 texture_t dummy_texture;
+                draw_stats_t draw_stats = {};
+                set_draw_stats(&draw_stats);
                 draw_model(FB_WIDTH, FB_HEIGHT, &vec_camera, current_model, &mat_world, gouraud_shading ? &mat_normal : NULL, &mat_proj, &mat_view, lights, nb_lights,
                            wireframe, textured ? &dummy_texture : NULL, clamp_s, clamp_t, 3, 6, perspective_correct);
+                set_draw_stats(NULL);
+                if (print_stats) print_draw_stats("Frame", draw_stats);
 
                 swap();
             }
@@ -545,6 +1088,34 @@ int main(int argc, char** argv, char** env) {
                         case SDL_SCANCODE_F1:
                             show_depth = !show_depth;
                             break;
+                        case SDL_SCANCODE_Z:
+                            g_swizzled_texture = !g_swizzled_texture;
+                            texture_dirty = true;
+                            printf("%s texture\n", g_swizzled_texture ? "Swizzled" : "Linear");
+                            break;
+                        case SDL_SCANCODE_F:
+                            g_texture_format = (g_texture_format + 1) % 3;
+                            texture_dirty = true;
+                            printf("%s texture\n", g_texture_format == TEXTURE_FORMAT_CLUT8    ? "CLUT8"
+                                                    : g_texture_format == TEXTURE_FORMAT_BLOCK4 ? "BLOCK4"
+                                                                                                : "ARGB4444");
+                            break;
+                        case SDL_SCANCODE_M:
+                            mipmaps = !mipmaps;
+                            set_texture_nb_levels(mipmaps ? TEXTURE_NB_LEVELS : 1);
+                            printf("Mipmaps %s\n", mipmaps ? "enabled" : "disabled");
+                            break;
+                        case SDL_SCANCODE_C:
+                            print_stats = !print_stats;
+                            break;
+                        case SDL_SCANCODE_X:
+                            g_fast_clear = !g_fast_clear;
+                            printf("%s clear\n", g_fast_clear ? "Fast" : "Full");
+                            break;
+                        case SDL_SCANCODE_K:
+                            packed_commands = !packed_commands;
+                            printf("%s commands\n", packed_commands ? "Packed" : "Unpacked");
+                            break;
                         default:
                             break;
                     }
@@ -574,17 +1145,7 @@ int main(int argc, char** argv, char** env) {
             }
         }
 
-        if (top->vram_sel_o) {
-            if (top->vram_addr_o < VRAM_SIZE) {
-
-                if (top->vram_wr_o) {
-                    vram_data[top->vram_addr_o] = top->vram_data_out_o;
-                }
-                top->vram_data_in_i = vram_data[top->vram_addr_o];
-            } else {
-                top->vram_data_in_i = 0xF800;
-            }
-        }
+        update_vram(top, vram_data);
 
         if (last_show_depth_value != show_depth_value) {
             printf("Displaying depth %d\n", show_depth_value);
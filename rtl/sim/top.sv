@@ -10,17 +10,25 @@ module top(
     input wire logic                   cmd_axis_tvalid_i,
     output logic                       cmd_axis_tready_o,
     input wire [31:0]                  cmd_axis_tdata_i,
+    output logic                       busy_o,
 
     // VRAM write
     output      logic                        vram_sel_o,
     output      logic                        vram_wr_o,
     output      logic  [3:0]                 vram_mask_o,
     output      logic [31:0]                 vram_addr_o,
-    input       logic [15:0]                 vram_data_in_i,
-    output      logic [15:0]                 vram_data_out_o,
+    input       logic [31:0]                 vram_data_in_i,
+    output      logic [31:0]                 vram_data_out_o,
 
     output      logic                        swap_o,
-    output      logic [31:0]                 front_addr_o
+    output      logic [31:0]                 front_addr_o,
+
+    // Benchmark
+    output      logic [31:0]                 nb_dsp_muls_o,
+    output      logic [31:0]                 nb_depth_tests_o,
+    output      logic [31:0]                 nb_covered_pixels_o,
+    output      logic                        rasterizing_o,
+    output      logic                        edge_setup_busy_o
     );
 
     logic        vram_sel;
@@ -39,6 +47,7 @@ module top(
         .cmd_axis_tvalid_i(cmd_axis_tvalid_i),
         .cmd_axis_tready_o(cmd_axis_tready_o),
         .cmd_axis_tdata_i(cmd_axis_tdata_i),
+        .busy_o(busy_o),
         .vram_sel_o(vram_sel_o),
         .vram_wr_o(vram_wr_o),
         .vram_mask_o(vram_mask_o),
@@ -51,5 +60,11 @@ module top(
         .clear_o()
     );
 
+    assign nb_dsp_muls_o = graphite.nb_dsp_muls;
+    assign nb_depth_tests_o = graphite.nb_depth_tests;
+    assign nb_covered_pixels_o = graphite.nb_covered_pixels;
+    assign rasterizing_o = graphite.is_rasterizing;
+    assign edge_setup_busy_o = graphite.edge_setup_state != 0;    // EDGE_SETUP_IDLE
+
 endmodule
 
@@ -21,7 +21,8 @@ module fifo #(
     input  wire logic [DATA_WIDTH-1:0] writer_d_i,
     input  wire logic                  writer_enq_i,    // enqueue
     output      logic                  writer_full_o,
-    output      logic                  writer_alm_full_o
+    output      logic                  writer_alm_full_o,
+    output      logic [ADDR_LEN-1:0]   writer_nb_free_o // number of entries that can be enqueued
 );
 
     localparam MEM_SIZE = 2 ** ADDR_LEN;
@@ -55,6 +56,7 @@ module fifo #(
 
     assign writer_full_o      = (head == tail + 1);
     assign writer_alm_full_o  = (head == tail + 2) || (head == tail + 1);
+    assign writer_nb_free_o   = ADDR_LEN'(head - tail - 1);
 
     logic ram_we;
     assign ram_we = writer_enq_i && !writer_full_o;
@@ -0,0 +1,85 @@
+// graphite_dma.sv
+// Copyright (c) 2024 Daniel Cliche
+// SPDX-License-Identifier: MIT
+
+// Fetch graphite commands from memory and stream them to the accelerator.
+// The CPU sets the read address, then adds the number of 32-bit words written at that address,
+// as many times as needed. The words are fetched one at a time through the cache.
+
+module graphite_dma(
+    input  wire logic        clk,
+    input  wire logic        reset_i,
+    input  wire logic        ce_i,
+
+    // Control
+    input  wire logic        set_address_i,
+    input  wire logic        add_nb_words_i,
+    input  wire logic [31:0] data_i,
+    output      logic [31:0] address_o,         // byte address of the next word to fetch
+    output      logic [31:0] nb_words_o,        // number of words left to fetch
+    output      logic        busy_o,
+
+    // Memory read
+    output      logic        mem_sel_o,
+    input  wire logic [31:0] mem_data_i,
+
+    // AXI stream command interface (master)
+    output      logic        cmd_axis_tvalid_o,
+    input  wire logic        cmd_axis_tready_i,
+    output      logic [31:0] cmd_axis_tdata_o
+);
+
+    enum { IDLE, FETCH0, FETCH1, SEND } state;
+
+    logic is_sent;
+
+    assign busy_o = (nb_words_o != 32'd0) || (state != IDLE);
+    assign is_sent = ce_i && (state == SEND) && cmd_axis_tready_i;
+
+    always_ff @(posedge clk) begin
+        if (reset_i) begin
+            state             <= IDLE;
+            address_o         <= 32'd0;
+            nb_words_o        <= 32'd0;
+            mem_sel_o         <= 1'b0;
+            cmd_axis_tvalid_o <= 1'b0;
+        end else begin
+            // the control registers are written by the CPU, regardless of the clock enable
+            if (set_address_i)
+                address_o <= data_i;
+            else if (is_sent)
+                address_o <= address_o + 32'd4;
+
+            nb_words_o <= nb_words_o + (add_nb_words_i ? data_i : 32'd0) - (is_sent ? 32'd1 : 32'd0);
+
+            if (ce_i) case (state)
+                IDLE: begin
+                    if (nb_words_o != 32'd0) begin
+                        mem_sel_o <= 1'b1;
+                        state     <= FETCH0;
+                    end
+                end
+
+                FETCH0: begin
+                    // the cache reads the word during this cycle
+                    mem_sel_o <= 1'b0;
+                    state     <= FETCH1;
+                end
+
+                FETCH1: begin
+                    cmd_axis_tdata_o  <= mem_data_i;
+                    cmd_axis_tvalid_o <= 1'b1;
+                    state             <= SEND;
+                end
+
+                SEND: begin
+                    if (cmd_axis_tready_i) begin
+                        cmd_axis_tvalid_o <= 1'b0;
+                        state             <= IDLE;
+                    end
+                end
+            endcase
+        end
+    end
+
+endmodule
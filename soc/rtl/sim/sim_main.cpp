@@ -4,6 +4,7 @@
 
 #include <SDL.h>
 
+#include <cstdio>
 #include <memory>
 #include <chrono>
 #include <deque>
@@ -19,6 +20,25 @@
 #include "sdl_ps2.h"
 
 #define SDRAM_MEM_SIZE (32*1024*1024/2)
+#define CPU_CLOCK_HZ 25000000   // FREQ_HZ of soc_top
+#define UART_BAUD_RATE 115200   // BAUD_RATE of soc_top
+
+// Benchmark (+benchmark): the frames of test_graphite with and without its display lists and packed commands, which
+// are toggled by typing 'k' and 'd' on its UART. Each step is measured after the frames drawn while the key is handled.
+struct BenchmarkStep {
+    const char *name;
+    char key;   // typed at the start of the step, 0 for none
+};
+
+static const BenchmarkStep benchmark_steps[] = {
+    {"display lists, packed commands", 0},
+    {"display lists, unpacked commands", 'k'},
+    {"CPU commands, unpacked", 'd'},
+    {"CPU commands, packed", 'k'},
+};
+
+#define BENCHMARK_WARMUP_FRAMES 2
+#define BENCHMARK_NB_FRAMES 4
 
 const int screen_width = 1024;
 const int screen_height = 768;
@@ -109,6 +129,7 @@ int main(int argc, char **argv, char **env)
         contextp->commandArgs(argc, argv);
 
         restart_model = false;
+        bool is_benchmark = contextp->commandArgsPlusMatch("benchmark")[0] != '\0';
 
         // Construct the Verilated model, from Vtop.h generated from Verilating "top.v".
         // Using unique_ptr is similar to "Vtop* top = new Vtop" then deleting at end.
@@ -144,6 +165,42 @@ int main(int argc, char **argv, char **env)
 
         bool manual_reset = false;
 
+        // CPU / graphite activity, in CPU clock cycles
+        uint64_t nb_cycles = 0;
+        uint64_t nb_graphite_busy_cycles = 0;
+        uint64_t nb_cpu_stalled_cycles = 0;
+        uint64_t nb_overlap_cycles = 0;
+
+        // Frames drawn by graphite (swaps of its frame buffers) and their cycles
+        uint64_t total_nb_cycles = 0;
+        uint64_t nb_graphite_frames = 0;
+        uint64_t nb_graphite_frame_cycles = 0;
+        uint64_t graphite_frame_start = 0;     // cycle of the last swap, 0 before the first one
+        bool last_graphite_swap = false;
+
+        // SDRAM row activations (row misses), all and while graphite is busy
+        uint64_t nb_sdram_activates = 0;
+        uint64_t nb_graphite_sdram_activates = 0;
+
+        // Bytes sent to rx_i, one start bit, 8 data bits (LSB first) and one stop bit
+        std::deque<uint8_t> uart_bytes;
+        int uart_bit = -1;              // 0 to 9, -1 while idle
+        int uart_bit_cycles = 0;
+        top->rx_i = 1;
+
+        // Benchmark counters of the measured frames of the step
+        size_t benchmark_step = 0;
+        int benchmark_frame = 0;        // swaps since the start of the step
+        uint64_t benchmark_cycles = 0;
+        uint64_t benchmark_graphite_busy_cycles = 0;
+        uint64_t benchmark_cpu_stalled_cycles = 0;
+        uint64_t benchmark_overlap_cycles = 0;
+        uint64_t benchmark_sdram_activates = 0;
+        if (is_benchmark) {
+            printf("test_graphite benchmark, command FIFO of %d words, %d frames per step\n",
+                   GRAPHITE_FIFO_ADDR_LEN > 0 ? (1 << GRAPHITE_FIFO_ADDR_LEN) - 1 : 0, BENCHMARK_NB_FRAMES);
+        }
+
         while (!contextp->gotFinish() && !quit)
         {
             bool toggle_clk = !(clk_counter & 0x1);
@@ -168,6 +225,11 @@ int main(int argc, char **argv, char **env)
                     uint32_t sdram_bank = top->sdram_ba_o;
                     if (!top->sdram_ras_n_o && top->sdram_cas_n_o && top->sdram_we_n_o) {
                         sdram_rows[sdram_bank] = top->sdram_a_o;
+                        nb_sdram_activates++;
+                        if (benchmark_frame >= BENCHMARK_WARMUP_FRAMES)
+                            benchmark_sdram_activates++;
+                        if (top->graphite_busy_o)
+                            nb_graphite_sdram_activates++;
                         //printf("ACT bank=%d, row=%d\n", sdram_bank, sdram_rows[sdram_bank]);
                     }
                     uint32_t sdram_row = sdram_rows[sdram_bank];
@@ -235,6 +297,68 @@ int main(int argc, char **argv, char **env)
 
             // if posedge clk
             if (toggle_clk && top->clk) {
+
+                nb_cycles++;
+                total_nb_cycles++;
+                if (top->graphite_busy_o)
+                    nb_graphite_busy_cycles++;
+                if (!top->cpu_active_o)
+                    nb_cpu_stalled_cycles++;
+                if (top->graphite_busy_o && top->cpu_active_o)
+                    nb_overlap_cycles++;
+                if (is_benchmark && benchmark_frame >= BENCHMARK_WARMUP_FRAMES) {
+                    benchmark_cycles++;
+                    if (top->graphite_busy_o)
+                        benchmark_graphite_busy_cycles++;
+                    if (!top->cpu_active_o)
+                        benchmark_cpu_stalled_cycles++;
+                    if (top->graphite_busy_o && top->cpu_active_o)
+                        benchmark_overlap_cycles++;
+                }
+                if (top->graphite_swap_o && !last_graphite_swap) {
+                    if (graphite_frame_start > 0) {
+                        nb_graphite_frames++;
+                        nb_graphite_frame_cycles += total_nb_cycles - graphite_frame_start;
+                    }
+                    graphite_frame_start = total_nb_cycles;
+
+                    if (is_benchmark && ++benchmark_frame == BENCHMARK_WARMUP_FRAMES + BENCHMARK_NB_FRAMES) {
+                        double frame_cycles = (double)benchmark_cycles / BENCHMARK_NB_FRAMES;
+                        printf("%-32s %.0f cycles/frame (%.2f ms), graphite busy %.1f%%, CPU stalled %.1f%%, "
+                               "overlap %.1f%%, %.0f SDRAM row activations/frame\n",
+                               benchmark_steps[benchmark_step].name, frame_cycles,
+                               1000.0 * frame_cycles / CPU_CLOCK_HZ,
+                               100.0 * benchmark_graphite_busy_cycles / benchmark_cycles,
+                               100.0 * benchmark_cpu_stalled_cycles / benchmark_cycles,
+                               100.0 * benchmark_overlap_cycles / benchmark_cycles,
+                               (double)benchmark_sdram_activates / BENCHMARK_NB_FRAMES);
+                        benchmark_frame = 0;
+                        benchmark_cycles = 0;
+                        benchmark_graphite_busy_cycles = 0;
+                        benchmark_cpu_stalled_cycles = 0;
+                        benchmark_overlap_cycles = 0;
+                        benchmark_sdram_activates = 0;
+                        if (++benchmark_step == sizeof(benchmark_steps) / sizeof(benchmark_steps[0]))
+                            quit = true;
+                        else if (benchmark_steps[benchmark_step].key != 0)
+                            uart_bytes.push_back(benchmark_steps[benchmark_step].key);
+                    }
+                }
+                last_graphite_swap = top->graphite_swap_o;
+
+                if (uart_bit < 0 && !uart_bytes.empty())
+                    uart_bit = 0;
+                if (uart_bit >= 0) {
+                    uint8_t c = uart_bytes.front();
+                    top->rx_i = (uart_bit == 0) ? 0 : (uart_bit <= 8) ? (c >> (uart_bit - 1)) & 1 : 1;
+                    if (++uart_bit_cycles == CPU_CLOCK_HZ / UART_BAUD_RATE) {
+                        uart_bit_cycles = 0;
+                        if (++uart_bit == 10) {
+                            uart_bit = -1;
+                            uart_bytes.pop_front();
+                        }
+                    }
+                }
                 
                 if (top->ps2_kbd_strobe_i) {
                     top->ps2_kbd_strobe_i = 0;
@@ -360,6 +484,28 @@ int main(int argc, char **argv, char **env)
                 if (frame_counter % 100 == 0)
                 {
                     std::cout << "Clk speed: " << 1.0 / (duration_clk.count()) << " MHz\n";
+                    if (nb_cycles > 0) {
+                        // overlap: the CPU runs while graphite is busy
+                        std::cout << "Cycles: " << nb_cycles
+                                  << ", graphite busy: " << 100.0 * nb_graphite_busy_cycles / nb_cycles << "%"
+                                  << ", CPU stalled: " << 100.0 * nb_cpu_stalled_cycles / nb_cycles << "%"
+                                  << ", overlap: " << 100.0 * nb_overlap_cycles / nb_cycles << "%\n";
+                        std::cout << "SDRAM row activations: " << nb_sdram_activates
+                                  << ", while graphite busy: " << nb_graphite_sdram_activates << "\n";
+                    }
+                    if (nb_graphite_frames > 0) {
+                        double frame_cycles = (double)nb_graphite_frame_cycles / nb_graphite_frames;
+                        std::cout << "Graphite frames: " << nb_graphite_frames << ", " << frame_cycles
+                                  << " cycles/frame (" << 1000.0 * frame_cycles / CPU_CLOCK_HZ << " ms)\n";
+                    }
+                    nb_graphite_frames = 0;
+                    nb_graphite_frame_cycles = 0;
+                    nb_cycles = 0;
+                    nb_graphite_busy_cycles = 0;
+                    nb_cpu_stalled_cycles = 0;
+                    nb_overlap_cycles = 0;
+                    nb_sdram_activates = 0;
+                    nb_graphite_sdram_activates = 0;
                 }
 
                 tp_frame = tp_now;
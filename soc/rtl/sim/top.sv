@@ -2,7 +2,9 @@
 // Copyright (c) 2023-2024 Daniel Cliche
 // SPDX-License-Identifier: MIT
 
-module top (
+module top #(
+    parameter GRAPHITE_FIFO_ADDR_LEN = 9
+) (
     input  wire logic        clk,
     input  wire logic        clk_sdram,
     input  wire logic        reset_i,
@@ -30,12 +32,19 @@ module top (
     output      logic [12:0] sdram_a_o,
     output      logic [1:0]  sdram_ba_o,
     output      logic [1:0]  sdram_dqm_o,
-    inout       logic [15:0] sdram_dq_io  
+    inout       logic [15:0] sdram_dq_io,
+
+    // Activity
+    output      logic        cpu_active_o,
+    output      logic        graphite_busy_o,
+    output      logic        graphite_swap_o
     );
 
     assign sdram_cke_o = 1'b1; // SDRAM clock enable
 
-    soc_top soc_top
+    soc_top #(
+        .GRAPHITE_FIFO_ADDR_LEN(GRAPHITE_FIFO_ADDR_LEN)
+    ) soc_top
     (
         .clk_cpu(clk),
         .clk_sdram(clk_sdram),
@@ -43,7 +52,7 @@ module top (
         .reset_i(reset_i),
 
         // UART
-        .rx_i(),
+        .rx_i(rx_i),
         .tx_o(),
         // LED
         .led_o(display_o),
@@ -73,7 +82,11 @@ module top (
         .sdram_ba_o(sdram_ba_o),
         .sdram_addr_o(sdram_a_o),
         .sdram_data_io(sdram_dq_io),
-        .sdram_dqm_o(sdram_dqm_o)
+        .sdram_dqm_o(sdram_dqm_o),
+        // Activity
+        .cpu_active_o(cpu_active_o),
+        .graphite_busy_o(graphite_busy_o),
+        .graphite_swap_o(graphite_swap_o)
     );
 
     initial begin
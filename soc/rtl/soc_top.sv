@@ -31,7 +31,8 @@ CONNECTION WITH THE DEALINGS IN OR USE OR PERFORMANCE OF THE SOFTWARE.
 module soc_top #(
     parameter FREQ_HZ = 25_000_000,
     parameter BAUD_RATE = 115_200,
-    parameter DEFAULT_FB_ADDRESS = 32'h1000000
+    parameter DEFAULT_FB_ADDRESS = 32'h1000000,
+    parameter GRAPHITE_FIFO_ADDR_LEN = 9            // command FIFO of 2^n - 1 words, none if 0
 ) (
     input  wire logic        clk_cpu,
     input  wire logic        clk_sdram,
@@ -68,7 +69,11 @@ module soc_top #(
     output      logic [1:0]  sdram_ba_o,
     output      logic [12:0] sdram_addr_o,
     inout       logic [15:0] sdram_data_io,
-    output wire logic [1:0]  sdram_dqm_o
+    output wire logic [1:0]  sdram_dqm_o,
+    // Activity, for the performance counters of the simulation
+    output      logic        cpu_active_o,
+    output      logic        graphite_busy_o,
+    output      logic        graphite_swap_o
 );
 
     // IO addresses for input / output
@@ -80,8 +85,10 @@ module soc_top #(
     // 5  SPI status / SPI control
     // 6  PS2 keyboard / --
     // 7  mouse / --
-    // 8  graphite
+    // 8  graphite number of commands that can be written, 0 while the DMA is busy / graphite command
     // 9  -- / H resolution, V resolution
+    // 14 graphite DMA address
+    // 15 graphite DMA number of words left / number of words to add
     
 `ifdef VIDEO_480P
     localparam H_RES = 848;
@@ -115,6 +122,7 @@ module soc_top #(
     logic [15:0] RGB565;
     logic [23:0] RGB888;
     logic CE; 
+    logic cpu_ce, graphite_ce, dma_ce;  // CE of each memory master, low while waiting for the memory
     logic empty;
     logic qready = 1'b0;
     logic req_flush_cache;
@@ -180,7 +188,7 @@ module soc_top #(
     processor cpu(
         .clk(clk_cpu),
         .reset_i(~rst_n),
-        .ce_i(CE && !process_graphite),
+        .ce_i(cpu_ce),
 
         // interrupts (2)
         .irq_i(2'b00),
@@ -324,13 +332,20 @@ module soc_top #(
     // Graphite
     logic           graphite_cmd_axis_tvalid;
     logic           graphite_cmd_axis_tready;
+    logic           graphite_busy;
     logic [31:0]    graphite_cmd_axis_tdata;
 
+    // commands of the CPU streamed to graphite, through the command FIFO if there is one
+    logic           cpu_stream_tvalid;
+    logic [31:0]    cpu_stream_tdata;
+    logic           is_cpu_stream_busy;     // the commands of the CPU go first, the DMA waits for them
+    logic [31:0]    cpu_nb_free_commands;   // commands the CPU can write without waiting
+
     logic graphite_vram_sel;
     logic graphite_vram_wr;
     logic [3:0] graphite_vram_mask;
     logic [31:0] graphite_vram_addr;
-    logic [15:0] graphite_vram_data_in, graphite_vram_data_out;
+    logic [31:0] graphite_vram_data_out;
     logic [31:0] graphite_front_addr;
     logic graphite_clear;
     logic graphite_swap;
@@ -343,19 +358,20 @@ module soc_top #(
     ) graphite(
         .clk(clk_cpu),
         .reset_i(~rst_n),
-        .ce_i(CE),
+        .ce_i(graphite_ce),
 
         // AXI stream command interface (slave)
         .cmd_axis_tvalid_i(graphite_cmd_axis_tvalid),
         .cmd_axis_tready_o(graphite_cmd_axis_tready),
         .cmd_axis_tdata_i(graphite_cmd_axis_tdata),
+        .busy_o(graphite_busy),
 
         // VRAM write
         .vram_sel_o(graphite_vram_sel),
         .vram_wr_o(graphite_vram_wr),
         .vram_mask_o(graphite_vram_mask),
         .vram_addr_o(graphite_vram_addr),
-        .vram_data_in_i(graphite_vram_addr[0] ? inbus0[31:16] : inbus0[15:0]),
+        .vram_data_in_i(inbus0),
         .vram_data_out_o(graphite_vram_data_out),
 
         .vsync_i(vga_vsync),
@@ -364,6 +380,117 @@ module soc_top #(
         .clear_o(graphite_clear)
     );
 
+    // Graphite command DMA
+    logic           dma_busy;
+    logic [31:0]    dma_address;
+    logic [31:0]    dma_nb_words;
+    logic           dma_mem_sel;
+    logic           dma_cmd_axis_tvalid;
+    logic [31:0]    dma_cmd_axis_tdata;
+
+    graphite_dma graphite_dma(
+        .clk(clk_cpu),
+        .reset_i(~rst_n),
+        .ce_i(dma_ce),
+
+        .set_address_i(CE && wr && ioenb && (iowadr == 14)),
+        .add_nb_words_i(CE && wr && ioenb && (iowadr == 15)),
+        .data_i(outbus),
+        .address_o(dma_address),
+        .nb_words_o(dma_nb_words),
+        .busy_o(dma_busy),
+
+        .mem_sel_o(dma_mem_sel),
+        .mem_data_i(inbus0),
+
+        .cmd_axis_tvalid_o(dma_cmd_axis_tvalid),
+        // graphite only takes a word while its clock is enabled
+        .cmd_axis_tready_i(graphite_ce && graphite_cmd_axis_tready && !is_cpu_stream_busy),
+        .cmd_axis_tdata_o(dma_cmd_axis_tdata)
+    );
+
+    generate
+        if (GRAPHITE_FIFO_ADDR_LEN > 0) begin : graphite_cmd_fifo
+            // The CPU queues commands while graphite draws, as long as the FIFO has free slots
+            logic                              fifo_empty, fifo_deq, fifo_deq_q;
+            logic [31:0]                       fifo_q;
+            logic [GRAPHITE_FIFO_ADDR_LEN-1:0] fifo_nb_free;
+            logic                              is_sent;
+
+            fifo #(
+                .ADDR_LEN(GRAPHITE_FIFO_ADDR_LEN),
+                .DATA_WIDTH(32)
+            ) cmd_fifo(
+                .clk(clk_cpu),
+                .reset_i(~rst_n),
+                .reader_q_o(fifo_q),
+                .reader_deq_i(fifo_deq),
+                .reader_empty_o(fifo_empty),
+                .reader_alm_empty_o(),
+
+                .writer_d_i(outbus),
+                .writer_enq_i(CE && wr && ioenb && (iowadr == 8)),
+                .writer_full_o(),
+                .writer_alm_full_o(),
+                .writer_nb_free_o(fifo_nb_free)
+            );
+
+            // The head is read in the cycle after it moves, so a command is dequeued every other cycle at most.
+            // It stays in the stream register until graphite takes it.
+            assign is_sent  = graphite_ce && graphite_cmd_axis_tready && cpu_stream_tvalid;
+            assign fifo_deq = !fifo_empty && !fifo_deq_q && (!cpu_stream_tvalid || is_sent);
+
+            always_ff @(posedge clk_cpu) begin
+                if (~rst_n) begin
+                    cpu_stream_tvalid <= 1'b0;
+                    fifo_deq_q        <= 1'b0;
+                end else begin
+                    fifo_deq_q <= fifo_deq;
+                    if (fifo_deq) begin
+                        cpu_stream_tdata  <= fifo_q;
+                        cpu_stream_tvalid <= 1'b1;
+                    end else if (is_sent) begin
+                        cpu_stream_tvalid <= 1'b0;
+                    end
+                end
+            end
+
+            assign is_cpu_stream_busy   = cpu_stream_tvalid || !fifo_empty;
+            assign cpu_nb_free_commands = dma_busy ? 32'd0 : 32'(fifo_nb_free);
+        end else begin : graphite_cmd_direct
+            // The CPU must wait for the DMA to be idle before sending commands directly. A command is held until
+            // graphite takes it, since tready may drop after the CPU reads it (the raster ends, or graphite waits for
+            // the memory).
+            logic        cpu_cmd_axis_tvalid;
+            logic [31:0] cpu_cmd_axis_tdata;
+
+            always_ff @(posedge clk_cpu) begin
+                if (~rst_n) begin
+                    cpu_cmd_axis_tvalid <= 1'b0;
+                end else begin
+                    if (graphite_ce && graphite_cmd_axis_tready)
+                        cpu_cmd_axis_tvalid <= 1'b0;
+                    if (CE && wr && ioenb && (iowadr == 8)) begin
+                        cpu_cmd_axis_tdata  <= outbus[31:0];
+                        cpu_cmd_axis_tvalid <= 1'b1;
+                    end
+                end
+            end
+
+            assign cpu_stream_tvalid    = cpu_cmd_axis_tvalid;
+            assign cpu_stream_tdata     = cpu_cmd_axis_tdata;
+            assign is_cpu_stream_busy   = cpu_cmd_axis_tvalid;
+            assign cpu_nb_free_commands = {31'b0, graphite_cmd_axis_tready && !cpu_cmd_axis_tvalid && !dma_busy};
+        end
+    endgenerate
+
+    assign graphite_cmd_axis_tvalid = (dma_busy && !is_cpu_stream_busy) ? dma_cmd_axis_tvalid : cpu_stream_tvalid;
+    assign graphite_cmd_axis_tdata  = (dma_busy && !is_cpu_stream_busy) ? dma_cmd_axis_tdata : cpu_stream_tdata;
+
+    assign cpu_active_o    = cpu_ce;
+    assign graphite_busy_o = graphite_busy || dma_busy || is_cpu_stream_busy;
+    assign graphite_swap_o = graphite_swap;
+
     assign inbus = ~ioenb ? inbus0 :
     ((iowadr == 0) ? cnt1 :
         (iowadr == 1) ? {32'b0 } :
@@ -373,12 +500,14 @@ module soc_top #(
         (iowadr == 5) ? {31'b0, spiRdy} :
         (iowadr == 6) ? {3'b0, rdyKbd, 28'd0} :
         (iowadr == 7) ? {24'b0, dataKbd} :
-        (iowadr == 8) ? {31'b0, graphite_cmd_axis_tready} :
+        (iowadr == 8) ? cpu_nb_free_commands :
         (iowadr == 9) ? {16'(H_RES), 16'(V_RES)} :
         (iowadr == 10) ? {3'b0, rdyMs, 28'd0} :
         (iowadr == 11) ? {5'b0, dataMs} :
         (iowadr == 12) ? fb_addr :
         (iowadr == 13) ? {31'b0, vga_vsync} :
+        (iowadr == 14) ? dma_address :
+        (iowadr == 15) ? dma_nb_words :
         32'd0);
 
     assign dataTx = outbus[7:0];
@@ -417,21 +546,18 @@ module soc_top #(
         if (~rst_n) begin
             led_o <= 8'd0;
             spiCtrl <= 4'd0;
-            graphite_cmd_axis_tvalid <= 1'b0;
             req_flush_cache <= 1'b0;
             fb_addr <= DEFAULT_FB_ADDRESS;
             use_graphite_front_addr <= 1'b0;
         end else begin
-            graphite_cmd_axis_tvalid <= 1'b0;
             req_flush_cache <= 1'b0;
             if(CE && wr && ioenb) begin
                 if (iowadr == 1)
                     led_o <= outbus[7:0];
                 else if (iowadr == 5)
                     spiCtrl <= outbus[3:0];
-                else if (iowadr == 8) begin
-                    graphite_cmd_axis_tdata  <= outbus[31:0];
-                    graphite_cmd_axis_tvalid <= 1'b1;
+                else if (iowadr == 8 || iowadr == 15) begin
+                    // the command goes to graphite_cmd_fifo or graphite_cmd_direct
                     use_graphite_front_addr <= 1'b1;    // Graphite will handle the fb address
                 end else if (iowadr == 9) begin
                     if (outbus[0])
@@ -491,21 +617,48 @@ module soc_top #(
     logic cache_ctrl_mreq;
     logic [3:0] cache_ctrl_wmask;
 
-    logic process_graphite;
-    assign process_graphite = !cpu_sel && !graphite_cmd_axis_tready;
+    // Memory arbitration between graphite, its command DMA and the CPU (in this priority order).
+    // A read returns its data in the cycle after the access, so nobody else may access the cache in that cycle.
+    enum { MEM_NONE, MEM_GRAPHITE, MEM_DMA, MEM_CPU } mem_grant, last_mem_grant;
+
+    always_comb begin
+        mem_grant = MEM_NONE;
+        if (graphite_vram_sel && (last_mem_grant == MEM_NONE || last_mem_grant == MEM_GRAPHITE))
+            mem_grant = MEM_GRAPHITE;
+        else if (dma_mem_sel && !graphite_vram_sel && (last_mem_grant == MEM_NONE || last_mem_grant == MEM_DMA))
+            mem_grant = MEM_DMA;
+        else if (cpu_sel && mreq && !graphite_vram_sel && !dma_mem_sel && !graphite_clear &&
+                 (last_mem_grant == MEM_NONE || last_mem_grant == MEM_CPU))
+            mem_grant = MEM_CPU;
+    end
+
+    always_ff @(posedge clk_cpu) begin
+        if (~rst_n)
+            last_mem_grant <= MEM_NONE;
+        else if (CE)
+            last_mem_grant <= mem_grant;
+    end
+
+    // a master waiting for the memory is stalled
+    assign cpu_ce      = CE && !(cpu_sel && mreq && mem_grant != MEM_CPU);
+    assign graphite_ce = CE && !(graphite_vram_sel && mem_grant != MEM_GRAPHITE);
+    assign dma_ce      = CE && !(dma_mem_sel && mem_grant != MEM_DMA);
 
     always_comb begin
-        if (process_graphite) begin
+        if (mem_grant == MEM_GRAPHITE) begin
             cache_ctrl_adr = {graphite_vram_addr[31:1], 2'b0};
-            cache_ctrl_din = {graphite_vram_data_out, graphite_vram_data_out};
-            //cache_ctrl_din = {16'd0, graphite_vram_data_out};
+            cache_ctrl_din = graphite_vram_data_out;
             cache_ctrl_mreq = graphite_vram_sel;
-            cache_ctrl_wmask = graphite_vram_addr[0] ? {{2{graphite_vram_wr}}, 2'b0} : {2'b0, {2{graphite_vram_wr}}};
-            //cache_ctrl_wmask = {4{graphite_vram_wr}};
+            cache_ctrl_wmask = graphite_vram_mask & {4{graphite_vram_wr}};
+        end else if (mem_grant == MEM_DMA) begin
+            cache_ctrl_adr = dma_address;
+            cache_ctrl_din = 32'd0;
+            cache_ctrl_mreq = 1'b1;
+            cache_ctrl_wmask = 4'b0;
         end else begin
             cache_ctrl_adr = adr;
             cache_ctrl_din = outbus;
-            cache_ctrl_mreq = mreq;
+            cache_ctrl_mreq = mem_grant == MEM_CPU;
             cache_ctrl_wmask = wmask & {4{wr}};
         end
     end
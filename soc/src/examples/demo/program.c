@@ -47,12 +47,17 @@
 #define OP_SWAP 26
 #define OP_SET_TEX_ADDR 27
 #define OP_SET_FB_ADDR 28
+#define OP_DRAW_PACKED 29
+#define OP_SET_PALETTE 30
 
 #define MEM_WRITE(_addr_, _value_) (*((volatile unsigned int *)(_addr_)) = _value_)
 #define MEM_READ(_addr_) *((volatile unsigned int *)(_addr_))
 
 #define PARAM(x) (x)
 
+// Size of each of the two display lists, in words
+#define DISPLAY_LIST_SIZE 4096
+
 struct Command {
     uint32_t opcode : 8;
     uint32_t param : 24;
@@ -64,6 +69,23 @@ uint16_t *img = NULL;
 
 int nb_triangles;
 bool rasterizer_ena = true;
+bool packed_commands = true;
+bool swizzled_texture = true;   // texture uploaded in the layout of texture_swizzled_offset(), fewer SDRAM row misses
+int texture_format = TEXTURE_FORMAT_CLUT8;    // half the VRAM and reads of ARGB4444, lossless up to 256 colors
+bool use_display_lists = true;
+
+// Texture in VRAM (in 16-bit words), followed by its mipmaps
+uint32_t texture_address;
+uint32_t texture_width, texture_height;
+int texture_level = 0;          // level of the texture address set in graphite
+
+// While graphite fetches one display list from memory, the next one is filled
+uint32_t display_lists[2][DISPLAY_LIST_SIZE];
+int display_list_index = 0;
+size_t display_list_nb_words = 0;
+
+// Commands that can be written to graphite without reading its status, the slots of its command FIFO
+uint32_t nb_free_commands = 0;
 
 sd_context_t sd_ctx;
 
@@ -85,14 +107,58 @@ int write_sector(uint32_t sector, uint8_t *buffer, uint32_t sector_count) {
     return 1;
 }
 
+void kick_display_list(void)
+{
+    if (display_list_nb_words == 0)
+        return;
+
+    // wait for the previous list to be fetched
+    while (MEM_READ(GRAPHITE_DMA) != 0);
+    MEM_WRITE(GRAPHITE_DMA_ADDR, (uint32_t)display_lists[display_list_index]);
+    MEM_WRITE(GRAPHITE_DMA, display_list_nb_words);
+    nb_free_commands = 0;   // none until the list is fetched
+
+    display_list_index = 1 - display_list_index;
+    display_list_nb_words = 0;
+}
+
+void send_word(uint32_t w)
+{
+    if (use_display_lists) {
+        display_lists[display_list_index][display_list_nb_words++] = w;
+        if (display_list_nb_words == DISPLAY_LIST_SIZE)
+            kick_display_list();
+    } else {
+        while (nb_free_commands == 0)
+            nb_free_commands = MEM_READ(GRAPHITE);
+        nb_free_commands--;
+        MEM_WRITE(GRAPHITE, w);
+    }
+}
+
 void send_command(struct Command *cmd)
 {
-    while (!MEM_READ(GRAPHITE));
-    MEM_WRITE(GRAPHITE, (cmd->opcode << 24) | cmd->param);
+    send_word((cmd->opcode << 24) | cmd->param);
+}
+
+// Screen coordinates are packed with 2 fractional bits, which is the subpixel precision of the rasterizer
+uint32_t pack_xy(vec3d *p)
+{
+    return ((uint32_t)(PARAM(p->y) >> 12) << 16) | ((uint32_t)(PARAM(p->x) >> 12) & 0xFFFF);
+}
+
+void set_texture_address(uint32_t address)
+{
+    struct Command cmd;
+    cmd.opcode = OP_SET_TEX_ADDR;
+    cmd.param = address & 0xFFFF;
+    send_command(&cmd);
+    cmd.param = 0x10000 | (address >> 16);
+    send_command(&cmd);
 }
 
 void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y,
-                      bool depth_test, bool perspective_correct)                      
+                      int level, bool depth_test, bool perspective_correct)
 {
     nb_triangles++;
     if (!rasterizer_ena)
@@ -100,6 +166,37 @@ void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool c
 
     struct Command cmd;
 
+    if (tex != NULL && level != texture_level) {
+        uint32_t level_offset = texture_level_offset(texture_width, texture_height, level);
+        set_texture_address(texture_address + texture_format_size(texture_format, level_offset));
+        texture_level = level;
+    }
+
+    uint32_t draw_param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
+              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
+
+    draw_param |= texture_scale_x << 5;
+    draw_param |= texture_scale_y << 8;
+    draw_param |= swizzled_texture ? 1 << 11 : 0;
+    draw_param |= texture_format << 12;
+
+    if (packed_commands) {
+        cmd.opcode = OP_DRAW_PACKED;
+        cmd.param = draw_param;
+        send_command(&cmd);
+
+        for (int i = 0; i < 3; ++i) {
+            send_word(pack_xy(&p[i]));
+            send_word(PARAM(t[i].w));
+            send_word(PARAM(t[i].u));
+            send_word(PARAM(t[i].v));
+            send_word(PARAM(c[i].x));
+            send_word(PARAM(c[i].y));
+            send_word(PARAM(c[i].z));
+        }
+        return;
+    }
+
     cmd.opcode = OP_SET_X0;
     cmd.param = PARAM(p[0].x) & 0xFFFF;
     send_command(&cmd);
@@ -245,13 +342,7 @@ void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool c
     send_command(&cmd);
 
     cmd.opcode = OP_DRAW;
-
-    cmd.param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
-              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
-
-    cmd.param |= texture_scale_x << 5;
-    cmd.param |= texture_scale_y << 8;
-
+    cmd.param = draw_param;
     send_command(&cmd);
 }
 
@@ -270,7 +361,7 @@ void clear(unsigned int color)
 }
 
 bool load_texture(const char *path, int *texture_scale_x, int *texture_scale_y) {
-    uint32_t tex_addr = (0x1000000 >> 1) + 3 * fb_width * fb_height;
+    texture_address = (0x1000000 >> 1) + 3 * fb_width * fb_height;
 
     upng_t* png_image = upng_new_from_file(path);
     if (png_image != NULL) {
@@ -281,44 +372,93 @@ bool load_texture(const char *path, int *texture_scale_x, int *texture_scale_y)
         }
     }
 
-    struct Command cmd;
-    cmd.opcode = OP_SET_TEX_ADDR;
-    cmd.param = tex_addr & 0xFFFF;
-    send_command(&cmd);
-    cmd.param = 0x10000 | (tex_addr >> 16);
-    send_command(&cmd);
+    set_texture_address(texture_address);
+    texture_level = 0;
 
-    int texture_width = upng_get_width(png_image);
-    int texture_height = upng_get_height(png_image);
+    texture_width = upng_get_width(png_image);
+    texture_height = upng_get_height(png_image);
 
-    uint32_t* texture_buffer = (uint32_t *)upng_get_buffer(png_image);
+    *texture_scale_x = -5;
+    for (uint32_t w = texture_width; w >>= 1;) (*texture_scale_x)++;
 
-    uint16_t* vram = 0;
-    for (int t = 0; t < texture_height; ++t)
-        for (int s = 0; s < texture_width; ++s) {
+    *texture_scale_y = -5;
+    for (uint32_t h = texture_height; h >>= 1;) (*texture_scale_y)++;
 
-            uint8_t* tc = (uint8_t*)(&texture_buffer[(texture_width * t) + s]);
-            uint16_t cr = tc[0] >> 4;
-            uint16_t cg = tc[1] >> 4;
-            uint16_t cb = tc[2] >> 4;
-            uint16_t ca = tc[3] >> 4;
+    if (*texture_scale_x < 0 || *texture_scale_y < 0) {
+        printf("Invalid texture size\r\n");
+        upng_free(png_image);
+        return false;
+    }
 
-            vram[tex_addr++] = (ca << 12) | (cr << 8) | (cg << 4) | cb;
-        }
+    // The levels are generated in a linear buffer, then uploaded in the layout of the texture
+    int nb_levels = texture_nb_levels(*texture_scale_x, *texture_scale_y);
+    uint16_t* texels = malloc(texture_level_offset(texture_width, texture_height, nb_levels) * sizeof(uint16_t));
+    if (texels == NULL) {
+        printf("Not enough memory for the texture\r\n");
+        upng_free(png_image);
+        return false;
+    }
+
+    uint32_t* texture_buffer = (uint32_t *)upng_get_buffer(png_image);
+    for (uint32_t i = 0; i < texture_width * texture_height; ++i) {
+        uint8_t* tc = (uint8_t*)(&texture_buffer[i]);
+        uint16_t cr = tc[0] >> 4;
+        uint16_t cg = tc[1] >> 4;
+        uint16_t cb = tc[2] >> 4;
+        uint16_t ca = tc[3] >> 4;
+        texels[i] = (ca << 12) | (cr << 8) | (cg << 4) | cb;
+    }
 
     upng_free(png_image);
 
-    *texture_scale_x = -5;
-    while (texture_width >>= 1) (*texture_scale_x)++;
+    texture_generate_mipmaps(texels, texture_width, texture_height, nb_levels);
 
-    *texture_scale_y = -5;
-    while (texture_height >>= 1) (*texture_scale_y)++;
+    // The palette is shared by the levels
+    uint32_t nb_texels = texture_level_offset(texture_width, texture_height, nb_levels);
+    uint8_t* indices = NULL;
+    if (texture_format == TEXTURE_FORMAT_CLUT8) {
+        indices = malloc(nb_texels);
+        if (indices == NULL) {
+            printf("Not enough memory for the texture\r\n");
+            free(texels);
+            return false;
+        }
+        uint16_t palette[256];
+        texture_quantize_clut8(texels, nb_texels, palette, indices);
+        struct Command cmd;
+        cmd.opcode = OP_SET_PALETTE;
+        for (int i = 0; i < 256; ++i) {
+            cmd.param = (i << 16) | palette[i];
+            send_command(&cmd);
+        }
+    }
 
-    if (*texture_scale_x < 0 || *texture_scale_y < 0) {
-        printf("Invalid texture size\r\n");
-        return false;
+    uint16_t* vram = 0;
+    uint8_t* vram_bytes = (uint8_t*)&vram[texture_address];
+    for (int level = 0; level < nb_levels; ++level) {
+        uint32_t w = texture_width >> level, h = texture_height >> level;
+        uint32_t level_offset = texture_level_offset(texture_width, texture_height, level);
+        if (texture_format == TEXTURE_FORMAT_BLOCK4) {
+            texture_encode_block4(&texels[level_offset], w, h, swizzled_texture,
+                                  &vram[texture_address + texture_format_size(texture_format, level_offset)]);
+            continue;
+        }
+        for (uint32_t t = 0; t < h; ++t)
+            for (uint32_t s = 0; s < w; ++s) {
+                uint32_t offset = level_offset + (swizzled_texture ? texture_swizzled_offset(s, t, w, h) : w * t + s);
+                // the CLUT8 texels are bytes, the low byte of a word first
+                if (texture_format == TEXTURE_FORMAT_CLUT8)
+                    vram_bytes[offset] = indices[level_offset + w * t + s];
+                else
+                    vram[texture_address + offset] = texels[level_offset + w * t + s];
+            }
     }
 
+    free(indices);
+    free(texels);
+
+    set_texture_nb_levels(nb_levels);
+
     return true;
 }
 
@@ -400,6 +540,15 @@ bool load_mesh_obj_data(mesh_t *mesh, char *obj_filename) {
     return true;
 }
 
+vec3d_soa alloc_soa(size_t n)
+{
+    vec3d_soa v;
+    v.x = malloc(n * sizeof(fx32));
+    v.y = malloc(n * sizeof(fx32));
+    v.z = malloc(n * sizeof(fx32));
+    return v;
+}
+
 void swap()
 {
     struct Command cmd;
@@ -413,7 +562,8 @@ void print_help(void)
 {
     printf("[h]: help, [q]: quit, [s]: stats, [SPACE]: rotation,\r\n"
         "[t]: texture, [l]: lighting, [g]: gouraud shading, [w]: wireframe, [m]: model,\r\n"
-        "[u]: clamp s, [v] clamp t, [r] rasterizer ena, [p]: perspective correct\r\n");
+        "[u]: clamp s, [v] clamp t, [r] rasterizer ena, [p]: perspective correct, [k]: packed commands\r\n"
+        "[d]: display lists\r\n");
 }
 
 void main(void)
@@ -442,6 +592,12 @@ void main(void)
 
     mat4x4 mat_proj = matrix_make_projection(fb_width, fb_height, 60.0f);
 
+    // the rasterizer only scans the on-screen part of triangles, let it handle the ones crossing the screen edges
+    set_guard_band(256);
+
+    draw_stats_t draw_stats;
+    set_draw_stats(&draw_stats);
+
     // camera
     vec3d  vec_camera = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
     mat4x4 mat_view   = matrix_make_identity();
@@ -462,6 +618,10 @@ void main(void)
     printf("texture scale x,y: %d, %d\r\n", texture_scale_x, texture_scale_y);
 
     f22_model.triangles_to_raster = malloc(2 * f22_model.mesh.nb_faces * sizeof(triangle_t));
+    f22_model.transformed_vertices = alloc_soa(f22_model.mesh.nb_vertices);
+    f22_model.viewed_vertices = alloc_soa(f22_model.mesh.nb_vertices);
+    f22_model.transformed_normals = alloc_soa(f22_model.mesh.nb_normals);
+    mesh_init_soa(&f22_model.mesh, alloc_soa(f22_model.mesh.nb_vertices), alloc_soa(f22_model.mesh.nb_normals));
 
     model_t *model = &f22_model;
 
@@ -524,6 +684,11 @@ void main(void)
                 clamp_t = !clamp_t;
             } else if (c == 'r') {
                 rasterizer_ena = !rasterizer_ena;
+            } else if (c == 'k') {
+                packed_commands = !packed_commands;
+            } else if (c == 'd') {
+                kick_display_list();
+                use_display_lists = !use_display_lists;
             } else if (c == 'p') {
                 perspective_correct = !perspective_correct;
             } else if (c == 'g') {
@@ -555,10 +720,12 @@ void main(void)
         uint32_t t1_draw = MEM_READ(TIMER);
         texture_t dummy_texture;
         nb_triangles = 0;
+        draw_stats = (draw_stats_t){0};
         draw_model(fb_width, fb_height, &vec_camera, model, &mat_world, gouraud_shading ? &mat_normal : NULL, &mat_proj, &mat_view, lights, nb_lights, is_wireframe, is_textured ? &dummy_texture : NULL, clamp_s, clamp_t, texture_scale_x, texture_scale_y, perspective_correct);
         uint32_t t2_draw = MEM_READ(TIMER);
 
         swap();
+        kick_display_list();
 
         if (is_rotating) {
             theta += 0.1f;
@@ -570,6 +737,13 @@ void main(void)
 
         if (print_stats)
             printf("xform: %d ms, clear: %d ms, draw: %d ms, total: %d ms, nb triangles: %d, tri/sec: %d\r\n", t2_xform - t1_xform, t2_clear - t1_clear, t2_draw - t1_draw, t2 - t1, nb_triangles, nb_triangles * 1000 / (t2 - t1));
+        if (print_stats)
+            printf("faces: %d, culled: %d, near clipped: %d, offscreen: %d, screen clipped: %d, emitted: %d, "
+                   "degenerate: %d, bbox pixels: %d, per light: %d\r\n", draw_stats.nb_faces,
+                   draw_stats.nb_faces_culled, draw_stats.nb_faces_near_clipped, draw_stats.nb_triangles_offscreen,
+                   draw_stats.nb_triangles_screen_clipped, draw_stats.nb_triangles_emitted,
+                   draw_stats.nb_triangles_degenerate, draw_stats.nb_bounding_box_pixels,
+                   draw_stats.nb_light_bounding_box_pixels);
     }
 
     fl_shutdown();
@@ -15,6 +15,8 @@
 #define KEYBOARD_DATA   (BASE_IO + 28)
 #define GRAPHITE        (BASE_IO + 32)
 #define RES             (BASE_IO + 36)
+#define GRAPHITE_DMA_ADDR (BASE_IO + 56)
+#define GRAPHITE_DMA    (BASE_IO + 60)
 
 #define MEM_WRITE(_addr_, _value_) (*((volatile unsigned int *)(_addr_)) = _value_)
 #define MEM_READ(_addr_) *((volatile unsigned int *)(_addr_))
@@ -44,12 +44,16 @@
 #define OP_SWAP 26
 #define OP_SET_TEX_ADDR 27
 #define OP_SET_FB_ADDR 28
+#define OP_DRAW_PACKED 29
 
 #define MEM_WRITE(_addr_, _value_) (*((volatile unsigned int *)(_addr_)) = _value_)
 #define MEM_READ(_addr_) *((volatile unsigned int *)(_addr_))
 
 #define PARAM(x) (x)
 
+// Size of each of the two display lists, in words
+#define DISPLAY_LIST_SIZE 4096
+
 struct Command {
     uint32_t opcode : 8;
     uint32_t param : 24;
@@ -62,22 +66,90 @@ extern uint16_t tex64x64[];
 
 int nb_triangles;
 bool rasterizer_ena = true;
+bool packed_commands = true;
+bool use_display_lists = true;
+
+// While graphite fetches one display list from memory, the next one is filled
+uint32_t display_lists[2][DISPLAY_LIST_SIZE];
+int display_list_index = 0;
+size_t display_list_nb_words = 0;
+
+// Commands that can be written to graphite without reading its status, the slots of its command FIFO
+uint32_t nb_free_commands = 0;
+
+void kick_display_list(void)
+{
+    if (display_list_nb_words == 0)
+        return;
+
+    // wait for the previous list to be fetched
+    while (MEM_READ(GRAPHITE_DMA) != 0);
+    MEM_WRITE(GRAPHITE_DMA_ADDR, (uint32_t)display_lists[display_list_index]);
+    MEM_WRITE(GRAPHITE_DMA, display_list_nb_words);
+    nb_free_commands = 0;   // none until the list is fetched
+
+    display_list_index = 1 - display_list_index;
+    display_list_nb_words = 0;
+}
+
+void send_word(uint32_t w)
+{
+    if (use_display_lists) {
+        display_lists[display_list_index][display_list_nb_words++] = w;
+        if (display_list_nb_words == DISPLAY_LIST_SIZE)
+            kick_display_list();
+    } else {
+        while (nb_free_commands == 0)
+            nb_free_commands = MEM_READ(GRAPHITE);
+        nb_free_commands--;
+        MEM_WRITE(GRAPHITE, w);
+    }
+}
 
 void send_command(struct Command *cmd)
 {
-    while (!MEM_READ(GRAPHITE));
-    MEM_WRITE(GRAPHITE, (cmd->opcode << 24) | cmd->param);
+    send_word((cmd->opcode << 24) | cmd->param);
+}
+
+// Screen coordinates are packed with 2 fractional bits, which is the subpixel precision of the rasterizer
+uint32_t pack_xy(vec3d *p)
+{
+    return ((uint32_t)(PARAM(p->y) >> 12) << 16) | ((uint32_t)(PARAM(p->x) >> 12) & 0xFFFF);
 }
 
 void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool clamp_s, bool clamp_t, int texture_scale_x, int texture_scale_y,
-                      bool depth_test, bool perspective_correct)                      
+                      int texture_level, bool depth_test, bool perspective_correct)
 {
+    // the texture has no mipmaps, texture_level is always 0
     nb_triangles++;
     if (!rasterizer_ena)
         return;
 
     struct Command cmd;
 
+    uint32_t draw_param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
+              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
+
+    draw_param |= texture_scale_x << 5;
+    draw_param |= texture_scale_y << 8;
+
+    if (packed_commands) {
+        cmd.opcode = OP_DRAW_PACKED;
+        cmd.param = draw_param;
+        send_command(&cmd);
+
+        for (int i = 0; i < 3; ++i) {
+            send_word(pack_xy(&p[i]));
+            send_word(PARAM(t[i].w));
+            send_word(PARAM(t[i].u));
+            send_word(PARAM(t[i].v));
+            send_word(PARAM(c[i].x));
+            send_word(PARAM(c[i].y));
+            send_word(PARAM(c[i].z));
+        }
+        return;
+    }
+
     cmd.opcode = OP_SET_X0;
     cmd.param = PARAM(p[0].x) & 0xFFFF;
     send_command(&cmd);
@@ -223,13 +295,7 @@ void xd_draw_triangle(vec3d p[3], vec2d t[3], vec3d c[3], texture_t* tex, bool c
     send_command(&cmd);
 
     cmd.opcode = OP_DRAW;
-
-    cmd.param = (depth_test ? 0b01000 : 0b00000) | (clamp_s ? 0b00100 : 0b00000) | (clamp_t ? 0b00010 : 0b00000) |
-              ((tex != NULL) ? 0b00001 : 0b00000) | (perspective_correct ? 0b10000 : 0xb00000);
-
-    cmd.param |= texture_scale_x << 5;
-    cmd.param |= texture_scale_y << 8;
-
+    cmd.param = draw_param;
     send_command(&cmd);
 }
 
@@ -272,8 +338,8 @@ void print_help(void)
 {
     printf("[h]: help, [q]: quit, [s]: stats, [SPACE]: rotation,\r\n"
         "[t]: texture, [l]: lighting, [g]: gouraud shading, [w]: wireframe, [m]: teapot/cube,\r\n"
-        "[u]: clamp s, [v] clamp t, [r] rasterizer ena, [p]: perspective correct\r\n"
-        "[0]: texture 32x32, [1]: texture 64x64\r\n");
+        "[u]: clamp s, [v] clamp t, [r] rasterizer ena, [p]: perspective correct, [k]: packed commands\r\n"
+        "[d]: display lists, [0]: texture 32x32, [1]: texture 64x64\r\n");
 }
 
 void main(void)
@@ -288,6 +354,9 @@ void main(void)
 
     mat4x4 mat_proj = matrix_make_projection(fb_width, fb_height, 60.0f);
 
+    // the rasterizer only scans the on-screen part of triangles, let it handle the ones crossing the screen edges
+    set_guard_band(256);
+
     // camera
     vec3d  vec_camera = {FX(0.0f), FX(0.0f), FX(0.0f), FX(1.0f)};
     mat4x4 mat_view   = matrix_make_identity();
@@ -361,6 +430,11 @@ void main(void)
                 clamp_t = !clamp_t;
             } else if (c == 'r') {
                 rasterizer_ena = !rasterizer_ena;
+            } else if (c == 'k') {
+                packed_commands = !packed_commands;
+            } else if (c == 'd') {
+                kick_display_list();
+                use_display_lists = !use_display_lists;
             } else if (c == 'p') {
                 perspective_correct = !perspective_correct;
             } else if (c == 'g') {
@@ -399,6 +473,7 @@ void main(void)
         uint32_t t2_draw = MEM_READ(TIMER);
 
         swap();
+        kick_display_list();
 
         if (is_rotating) {
             theta += 0.1f;
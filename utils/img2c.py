@@ -1,15 +1,97 @@
-
 import sys
 import os
 from PIL import Image
 
-if len(sys.argv) != 3:
-    print('Usage: python {} image.png array.c'.format(sys.argv[0]))
+# With --mipmaps, the levels of texture_generate_mipmaps() follow the image, down to 32 texels on the smallest side.
+# With --format, the texels are converted as texture_quantize_clut8() (a palette array follows) or
+# texture_encode_block4() (linear layout) do.
+FORMATS = ['argb4444', 'clut8', 'block4']
+
+mipmaps = False
+texture_format = 'argb4444'
+args = []
+argv = sys.argv[1:]
+while argv:
+    arg = argv.pop(0)
+    if arg == '--mipmaps':
+        mipmaps = True
+    elif arg == '--format' and argv and argv[0] in FORMATS:
+        texture_format = argv.pop(0)
+    else:
+        args.append(arg)
+
+if len(args) != 2:
+    print('Usage: python {} [--mipmaps] [--format argb4444|clut8|block4] image.png array.c'.format(sys.argv[0]))
     sys.exit(1)
 
-im = Image.open(sys.argv[1])
 
-with open(sys.argv[2], 'w') as f:
+# 2x2 box filter of ARGB4444 texels, rounded
+def texel_average(texels):
+    texel = 0
+    for shift in range(0, 16, 4):
+        total = sum((t >> shift) & 0xF for t in texels)
+        texel |= ((total + 2) >> 2) << shift
+    return texel
+
+
+def next_level(level, width, height):
+    return [texel_average([level[2 * y * width + 2 * x], level[2 * y * width + 2 * x + 1],
+                           level[(2 * y + 1) * width + 2 * x], level[(2 * y + 1) * width + 2 * x + 1]])
+            for y in range(height // 2) for x in range(width // 2)]
+
+
+def texel_distance(a, b):
+    return sum((((a >> shift) & 0xF) - ((b >> shift) & 0xF)) ** 2 for shift in range(0, 16, 4))
+
+
+# Index of the nearest color, the first one on a tie
+def nearest_color(texel, colors):
+    return min(range(len(colors)), key=lambda i: (texel_distance(texel, colors[i]), i))
+
+
+# Palette of the 256 most frequent colors, then by color, and index of the nearest palette color of each texel
+def quantize_clut8(texels):
+    counts = {}
+    for texel in texels:
+        counts[texel] = counts.get(texel, 0) + 1
+    palette = sorted(counts, key=lambda c: (-counts[c], c))[:256]
+    indices = {color: nearest_color(color, palette) for color in counts}
+    return palette + [0] * (256 - len(palette)), [indices[texel] for texel in texels]
+
+
+# (2 * a + b) / 3 per component, rounded
+def texel_mix(a, b):
+    texel = 0
+    for shift in range(0, 16, 4):
+        texel |= ((2 * ((a >> shift) & 0xF) + ((b >> shift) & 0xF) + 1) // 3) << shift
+    return texel
+
+
+# 4x4 blocks of 4 words row by row: the 2 most distant texels, then the 2-bit indices in them and their mixes
+def encode_block4(texels, width, height):
+    blocks = []
+    for by in range(0, height, 4):
+        for bx in range(0, width, 4):
+            block_texels = [texels[(by + i // 4) * width + bx + i % 4] for i in range(16)]
+            c0 = c1 = block_texels[0]
+            max_distance = 0
+            for i in range(16):
+                for j in range(i + 1, 16):
+                    distance = texel_distance(block_texels[i], block_texels[j])
+                    if distance > max_distance:
+                        c0, c1, max_distance = block_texels[i], block_texels[j], distance
+            colors = [c0, c1, texel_mix(c0, c1), texel_mix(c1, c0)]
+            words = [c0, c1, 0, 0]
+            for i, texel in enumerate(block_texels):
+                words[2 + i // 8] |= nearest_color(texel, colors) << (2 * (i % 8))
+            blocks += words
+    return blocks
+
+
+im = Image.open(args[0])
+name = os.path.splitext(os.path.basename(args[0]))[0]
+
+with open(args[1], 'w') as f:
     while True:
         rgb_im = im.convert('RGBA')
         size = rgb_im.size
@@ -24,8 +106,24 @@ with open(sys.argv[2], 'w') as f:
                 b = rgba[2] >> 4
                 array.append(a << 12 | r << 8 | g << 4 | b)
 
+        levels = [(array, size[0], size[1])]
+        if mipmaps:
+            while min(levels[-1][1], levels[-1][2]) > 32:
+                level, width, height = levels[-1]
+                levels.append((next_level(level, width, height), width // 2, height // 2))
+                array = array + levels[-1][0]
+
         f.write('#include <stdint.h>\n\n')
-        f.write('uint16_t {}[] = {{'.format(os.path.splitext(os.path.basename(sys.argv[1]))[0]))
+        if texture_format == 'clut8':
+            palette, array = quantize_clut8(array)
+            f.write('uint16_t {}_palette[] = {{'.format(name))
+            f.write(str(palette)[1:-1])
+            f.write('};\n')
+            f.write('uint8_t {}[] = {{'.format(name))
+        else:
+            if texture_format == 'block4':
+                array = [word for level in levels for word in encode_block4(*level)]
+            f.write('uint16_t {}[] = {{'.format(name))
         f.write(str(array)[1:-1])
         f.write('};\n')
 